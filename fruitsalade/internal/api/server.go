@@ -12,7 +12,9 @@ import (
 	"io/fs"
 	"log"
 	"mime"
+	"mime/multipart"
 	"net/http"
+	"net/textproto"
 	"os"
 	"path/filepath"
 	"regexp"
@@ -231,6 +233,7 @@ func (s *Server) Handler() http.Handler {
 	protected.HandleFunc("GET /api/v1/tree", s.handleTree)
 	protected.HandleFunc("GET /api/v1/tree/{path...}", s.handleSubtree)
 	protected.HandleFunc("GET /api/v1/content/{path...}", s.handleContent)
+	protected.HandleFunc("POST /api/v1/content-batch", s.handleContentBatch)
 
 	// Write endpoints
 	protected.HandleFunc("POST /api/v1/content/{path...}", s.handleUpload)
@@ -778,6 +781,95 @@ func (s *Server) handleContent(w http.ResponseWriter, r *http.Request) {
 	}
 }
 
+// Limits for POST /api/v1/content-batch: enough for one Explorer window of
+// thumbnails, small enough that a batch cannot double as a bulk download.
+const (
+	maxBatchFiles     = 256
+	maxBatchHeadBytes = 1 << 20
+)
+
+// handleContentBatch serves the leading bytes of several files in one round
+// trip (POST /api/v1/content-batch). Clients use it to warm caches ahead of
+// a predictable read storm — Explorer reading the head of every file in a
+// folder for thumbnails — where per-file Range requests would cost one
+// round trip each. Files are looked up by ID like the FUSE-compat path of
+// handleContent; the response is multipart/mixed with one part per file,
+// carrying its ID in X-File-Id. Missing or unreadable files are skipped
+// rather than failing the batch.
+func (s *Server) handleContentBatch(w http.ResponseWriter, r *http.Request) {
+	var req protocol.ContentBatchRequest
+	if err := json.NewDecoder(r.Body).Decode(&req); err != nil {
+		s.sendError(w, http.StatusBadRequest, "invalid request body: "+err.Error())
+		return
+	}
+	if len(req.FileIDs) == 0 {
+		s.sendError(w, http.StatusBadRequest, "file_ids required")
+		return
+	}
+	if len(req.FileIDs) > maxBatchFiles {
+		s.sendError(w, http.StatusBadRequest,
+			fmt.Sprintf("too many files: max %d per batch", maxBatchFiles))
+		return
+	}
+	if req.Length <= 0 || req.Length > maxBatchHeadBytes {
+		s.sendError(w, http.StatusBadRequest,
+			fmt.Sprintf("length must be 1-%d bytes", maxBatchHeadBytes))
+		return
+	}
+
+	claims := auth.GetClaims(r.Context())
+
+	mw := multipart.NewWriter(w)
+	w.Header().Set("Content-Type", "multipart/mixed; boundary="+mw.Boundary())
+	w.WriteHeader(http.StatusOK)
+
+	var sent int64
+	for _, id := range req.FileIDs {
+		totalSize, err := s.metadata.GetFileSize(r.Context(), id)
+		if err != nil {
+			continue
+		}
+		length := req.Length
+		if totalSize < length {
+			length = totalSize
+		}
+		if length <= 0 {
+			continue
+		}
+		s3Key, _ := s.metadata.GetS3Key(r.Context(), id)
+
+		backend, _, err := s.storageRouter.ResolveForFile(r.Context(), nil, nil)
+		if err != nil {
+			continue
+		}
+		reader, _, err := backend.GetObject(r.Context(), s3Key, 0, length)
+		if err != nil {
+			metrics.RecordContentDownload(0, false)
+			continue
+		}
+
+		part, err := mw.CreatePart(textproto.MIMEHeader{
+			"X-File-Id":    {id},
+			"Content-Type": {"application/octet-stream"},
+		})
+		if err != nil {
+			reader.Close()
+			break // client went away; no point writing further parts
+		}
+		n, err := io.Copy(part, reader)
+		reader.Close()
+		sent += n
+		metrics.RecordContentDownload(n, err == nil)
+	}
+	if err := mw.Close(); err != nil {
+		logging.Warn("content batch transfer error", zap.Error(err))
+	}
+
+	if claims != nil {
+		s.quotaStore.TrackBandwidth(r.Context(), claims.UserID, 0, sent)
+	}
+}
+
 // ─── Upload ─────────────────────────────────────────────────────────────────
 
 func (s *Server) handleUpload(w http.ResponseWriter, r *http.Request) {
@@ -18,9 +18,12 @@ import (
 	"encoding/json"
 	"fmt"
 	"io"
+	"mime"
+	"mime/multipart"
 	"net/http"
 	"net/http/httptest"
 	"os"
+	"strings"
 	"testing"
 
 	_ "github.com/lib/pq"
@@ -294,6 +297,91 @@ func TestUploadAndDownload(t *testing.T) {
 	}
 }
 
+func TestContentBatch(t *testing.T) {
+	contentA := "batch content for file a"
+	contentB := "batch content for file b, somewhat longer"
+	uploadFile(t, "batch/a.txt", contentA)
+	uploadFile(t, "batch/b.txt", contentB)
+
+	// Resolve the files' IDs from the subtree.
+	req, _ := authReq("GET", testServer.URL+"/api/v1/tree/batch", nil)
+	resp, err := http.DefaultClient.Do(req)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer resp.Body.Close()
+	var tree protocol.TreeResponse
+	if err := json.NewDecoder(resp.Body).Decode(&tree); err != nil {
+		t.Fatal(err)
+	}
+	ids := map[string]string{} // name -> ID
+	for _, child := range tree.Root.Children {
+		ids[child.Name] = child.ID
+	}
+	if len(ids) != 2 {
+		t.Fatalf("expected 2 children in /batch, got %d", len(ids))
+	}
+
+	// Fetch the first 16 bytes of both files in one batch.
+	body, _ := json.Marshal(protocol.ContentBatchRequest{
+		FileIDs: []string{ids["a.txt"], ids["b.txt"]},
+		Length:  16,
+	})
+	req, _ = authReq("POST", testServer.URL+"/api/v1/content-batch", bytes.NewReader(body))
+	req.Header.Set("Content-Type", "application/json")
+	resp2, err := http.DefaultClient.Do(req)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer resp2.Body.Close()
+	if resp2.StatusCode != http.StatusOK {
+		b, _ := io.ReadAll(resp2.Body)
+		t.Fatalf("batch failed: %d %s", resp2.StatusCode, b)
+	}
+
+	mediaType, params, err := mime.ParseMediaType(resp2.Header.Get("Content-Type"))
+	if err != nil || !strings.HasPrefix(mediaType, "multipart/") {
+		t.Fatalf("unexpected content type %q", resp2.Header.Get("Content-Type"))
+	}
+
+	heads := map[string]string{} // ID -> data
+	mr := multipart.NewReader(resp2.Body, params["boundary"])
+	for {
+		part, err := mr.NextPart()
+		if err == io.EOF {
+			break
+		}
+		if err != nil {
+			t.Fatal(err)
+		}
+		data, _ := io.ReadAll(part)
+		heads[part.Header.Get("X-File-Id")] = string(data)
+	}
+
+	if len(heads) != 2 {
+		t.Fatalf("expected 2 parts, got %d", len(heads))
+	}
+	if got := heads[ids["a.txt"]]; got != contentA[:16] {
+		t.Errorf("a.txt head = %q, want %q", got, contentA[:16])
+	}
+	if got := heads[ids["b.txt"]]; got != contentB[:16] {
+		t.Errorf("b.txt head = %q, want %q", got, contentB[:16])
+	}
+
+	// An empty batch is a client error, not an empty response.
+	req, _ = authReq("POST", testServer.URL+"/api/v1/content-batch",
+		bytes.NewBufferString(`{"file_ids":[],"length":16}`))
+	req.Header.Set("Content-Type", "application/json")
+	resp3, err := http.DefaultClient.Do(req)
+	if err != nil {
+		t.Fatal(err)
+	}
+	defer resp3.Body.Close()
+	if resp3.StatusCode != http.StatusBadRequest {
+		t.Errorf("expected 400 for empty batch, got %d", resp3.StatusCode)
+	}
+}
+
 func TestVersioning(t *testing.T) {
 	// Upload v1
 	r1 := uploadFile(t, "versioned/file.txt", "version 1 content")
@@ -4,7 +4,7 @@ package winclient
 
 /*
 #cgo CFLAGS: -I${SRCDIR}/../../../windows
-#cgo LDFLAGS: -lcldapi -lole32
+#cgo LDFLAGS: -lcldapi -lole32 -lbcrypt
 
 #include "cfapi_shim.h"
 */
@@ -13,8 +13,14 @@ import "C"
 import (
 	"context"
 	"fmt"
+	"io"
 	"os"
+	"path/filepath"
+	"runtime"
+	"strconv"
+	"strings"
 	"sync"
+	"time"
 	"unsafe"
 
 	"github.com/fruitsalade/fruitsalade/shared/pkg/logger"
@@ -23,9 +29,12 @@ import (
 
 // CfAPIBackend implements Backend using Windows Cloud Files API.
 type CfAPIBackend struct {
-	syncRoot string
-	core     *ClientCore
-	connKey  C.CF_CONNECTION_KEY
+	syncRoot          string
+	core              *ClientCore
+	rootID            int32
+	connKey           C.CF_CONNECTION_KEY
+	lazyPopulation    bool
+	prefetchHeadBytes int64
 
 	mu        sync.Mutex
 	connected bool
@@ -40,24 +49,111 @@ func (b *CfAPIBackend) Name() string {
 	return "cfapi"
 }
 
-// globalCfAPIBackend is used by the CGO callback to route hydration requests.
-var globalCfAPIBackend *CfAPIBackend
+// Several backends (personal root plus team shares) can run in one process,
+// sharing the HTTP pool and cache. Shim callbacks carry a root ID; this
+// registry maps it back to the owning backend.
+var (
+	cfapiMu         sync.Mutex
+	cfapiRoots      = map[int32]*CfAPIBackend{}
+	cfapiNextRootID int32
+	cfapiPollOnce   sync.Once
+)
+
+func registerCfAPIRoot(b *CfAPIBackend) int32 {
+	cfapiMu.Lock()
+	defer cfapiMu.Unlock()
+	cfapiNextRootID++
+	cfapiRoots[cfapiNextRootID] = b
+	return cfapiNextRootID
+}
+
+func unregisterCfAPIRoot(id int32) {
+	cfapiMu.Lock()
+	defer cfapiMu.Unlock()
+	delete(cfapiRoots, id)
+}
+
+func lookupCfAPIRoot(id C.int) *CfAPIBackend {
+	cfapiMu.Lock()
+	defer cfapiMu.Unlock()
+	return cfapiRoots[int32(id)]
+}
+
+// In-flight hydration contexts, keyed by (connection, transfer) key, so the
+// shim's CANCEL_FETCH_DATA callback can abort the download the moment the
+// kernel abandons a request instead of letting the full range finish.
+type hydrationKey struct {
+	conn     int64
+	transfer int64
+}
+
+var (
+	hydrationCancelMu sync.Mutex
+	hydrationCancels  = map[hydrationKey]context.CancelFunc{}
+)
+
+// transferKeyValue extracts the integer value of a CF_TRANSFER_KEY. The SDK
+// type is a LARGE_INTEGER union, which cgo exposes opaquely; its QuadPart is
+// the first (and only) 8 bytes.
+func transferKeyValue(k C.CF_TRANSFER_KEY) int64 {
+	return *(*int64)(unsafe.Pointer(&k))
+}
+
+//export goCancelHydrationCallbackForRoot
+func goCancelHydrationCallbackForRoot(rootID C.int, transferKey, connKey C.longlong) {
+	hydrationCancelMu.Lock()
+	cancel := hydrationCancels[hydrationKey{int64(connKey), int64(transferKey)}]
+	hydrationCancelMu.Unlock()
+	if cancel != nil {
+		cancel()
+	}
+}
 
 func (b *CfAPIBackend) Start(ctx context.Context, core *ClientCore) error {
 	b.core = core
-	globalCfAPIBackend = b
+	b.rootID = registerCfAPIRoot(b)
 
 	if err := os.MkdirAll(b.syncRoot, 0755); err != nil {
 		return fmt.Errorf("create sync root: %w", err)
 	}
 
-	// Initialize CfAPI
-	hr := C.cfapi_init()
-	if hr != 0 {
-		return fmt.Errorf("cfapi_init failed: HRESULT 0x%08x", uint32(hr))
+	// On-demand population: register partial and fill directories lazily in
+	// goFetchPlaceholdersCallback instead of walking the whole tree up front.
+	// Set before connecting — the policy is part of the registration
+	// fingerprint the fast path below compares.
+	b.lazyPopulation = lazyPopulationEnabled()
+	if b.lazyPopulation {
+		C.cfapi_set_population_policy(1)
+	}
+
+	// Processes listed in FRUITSALADE_BULK_PROCESSES (comma-separated image
+	// names, e.g. our pin worker) hydrate in the bulk lane so they cannot
+	// starve interactive opens from Explorer or user applications.
+	if names := bulkProcessPriorityMap(); names != "" {
+		cMap := C.CString(names)
+		if hr := C.cfapi_set_process_priority_map(cMap); hr != 0 {
+			logger.Error("Invalid FRUITSALADE_BULK_PROCESSES: HRESULT 0x%08x", uint32(hr))
+		}
+		C.free(unsafe.Pointer(cMap))
 	}
 
-	// Register sync root
+	// Admission control: per-process token buckets plus a global in-flight
+	// ceiling keep a runaway indexer from turning one seat into a hydration
+	// storm against the server. Off unless configured.
+	if bps, burst, inflight, overrides, set := hydrationPolicyFromEnv(); set {
+		cOverrides := C.CString(overrides)
+		if hr := C.cfapi_set_hydration_policy(C.longlong(bps), C.longlong(burst),
+			C.longlong(inflight), cOverrides); hr != 0 {
+			logger.Error("Invalid FRUITSALADE_HYDRATION_PROCESS_BPS: HRESULT 0x%08x", uint32(hr))
+		}
+		C.free(unsafe.Pointer(cOverrides))
+	}
+
+	// Enumeration header prefetch: when a directory is browsed, the shim asks
+	// us (goPrefetchHeadersCallbackForRoot) to stage the head of every file
+	// in it, so Explorer's thumbnail reads are served from the block cache.
+	b.prefetchHeadBytes = prefetchHeadBytesFromEnv()
+
 	cRoot := C.CString(b.syncRoot)
 	defer C.free(unsafe.Pointer(cRoot))
 	cName := C.CString("FruitSalade")
@@ -65,33 +161,92 @@ func (b *CfAPIBackend) Start(ctx context.Context, core *ClientCore) error {
 	cVersion := C.CString("2.0")
 	defer C.free(unsafe.Pointer(cVersion))
 
-	hr = C.cfapi_register_sync_root(cRoot, cName, cVersion)
+	// Warm start: when the persisted registration fingerprint still matches,
+	// connect directly and skip the registration rewrite that dominated
+	// service start on slow profile disks. S_FALSE means register first.
+	hr := C.cfapi_connect_existing(cRoot, cName, cVersion, C.int(b.rootID), &b.connKey)
 	if hr != 0 {
-		return fmt.Errorf("cfapi_register_sync_root failed: HRESULT 0x%08x", uint32(hr))
+		if hr := C.cfapi_init(); hr != 0 {
+			return fmt.Errorf("cfapi_init failed: HRESULT 0x%08x", uint32(hr))
+		}
+		if hr := C.cfapi_register_sync_root(cRoot, cName, cVersion); hr != 0 {
+			return fmt.Errorf("cfapi_register_sync_root failed: HRESULT 0x%08x", uint32(hr))
+		}
+		if hr := C.cfapi_connect_sync_root(cRoot, C.int(b.rootID), &b.connKey); hr != 0 {
+			return fmt.Errorf("cfapi_connect_sync_root failed: HRESULT 0x%08x", uint32(hr))
+		}
 	}
+	b.connected = true
 
-	// Connect sync root
-	hr = C.cfapi_connect_sync_root(cRoot, &b.connKey)
-	if hr != 0 {
-		return fmt.Errorf("cfapi_connect_sync_root failed: HRESULT 0x%08x", uint32(hr))
+	// Open the persistent identity index (non-fatal: lookups fall back to
+	// the metadata tree when unavailable).
+	if hr := C.cfapi_index_open(cRoot); hr != 0 {
+		logger.Error("Placeholder index unavailable: HRESULT 0x%08x", uint32(hr))
 	}
-	b.connected = true
 
-	// Fetch metadata and create placeholders
-	if err := core.FetchMetadata(ctx); err != nil {
-		return fmt.Errorf("initial metadata fetch: %w", err)
+	// Write-back journal: the shim's root watcher records local edits here,
+	// and unconfirmed records survive a crash and are re-drained on the next
+	// start. Non-fatal: without it uploads still trigger from close events.
+	if hr := C.cfapi_journal_open(cRoot, C.int(b.rootID)); hr != 0 {
+		logger.Error("Write-back journal unavailable: HRESULT 0x%08x", uint32(hr))
 	}
 
-	tree := core.Metadata()
-	if tree != nil {
-		b.createPlaceholdersRecursive(tree, b.syncRoot)
+	// Operation journal: the shim logs every placeholder mutation so an
+	// unclean shutdown resumes from the last committed operation instead of
+	// re-walking the whole root. Non-fatal; without it recovery just falls
+	// back to the full verify.
+	if hr := C.cfapi_oplog_open(cRoot); hr != 0 {
+		logger.Error("Operation journal unavailable: HRESULT 0x%08x", uint32(hr))
+	} else {
+		var resume C.longlong
+		if hr := C.cfapi_recover(cRoot, &resume); hr == 0 && resume > 0 {
+			logger.Info("Recovered operation journal: resuming after op %d", int64(resume))
+		}
 	}
 
+	// Native block cache: re-hydrations of unchanged files are served from
+	// local disk instead of re-downloaded. Reuses the client's cache budget;
+	// non-fatal, misses just go to the server as before.
+	if core.Config.CacheDir != "" && core.Config.MaxCacheSize > 0 {
+		cBlockCache := C.CString(filepath.Join(core.Config.CacheDir, "blocks.fsbc"))
+		if hr := C.cfapi_set_block_cache(cBlockCache, C.longlong(core.Config.MaxCacheSize)); hr != 0 {
+			logger.Error("Block cache unavailable: HRESULT 0x%08x", uint32(hr))
+		}
+		C.free(unsafe.Pointer(cBlockCache))
+	}
+
+	// Placeholders from the previous session serve as soon as the connection
+	// is live; the initial metadata fetch runs in the background instead of
+	// gating startup, so an offline or slow start still brings the root up.
+	go func() {
+		if err := core.FetchMetadata(ctx); err != nil {
+			logger.Error("Initial metadata fetch: %v", err)
+			return
+		}
+		tree := core.Metadata()
+		if tree != nil && !b.lazyPopulation {
+			b.populateTree(tree)
+		}
+	}()
+
 	core.StartBackgroundLoops(ctx)
 
 	// Watch for metadata changes in background
 	go b.watchMetadataChanges(ctx)
 
+	// Drain the shim's native event ring (renames, deletes, closes, ...).
+	// The ring is shared by all roots, so one poller serves the process;
+	// events are routed back to their backend by root ID.
+	cfapiPollOnce.Do(func() {
+		go pollShimEvents()
+		go logShimStats()
+		go drainDirtyJournals()
+	})
+
+	if b.lazyPopulation {
+		logger.Info("On-demand population enabled (directories materialize on first enumeration)")
+	}
+
 	logger.Info("CfAPI backend started at %s", b.syncRoot)
 
 	// Block until context is cancelled
@@ -111,39 +266,345 @@ func (b *CfAPIBackend) Stop() error {
 	if b.connected {
 		cRoot := C.CString(b.syncRoot)
 		defer C.free(unsafe.Pointer(cRoot))
+		C.cfapi_flush_handles()
 		C.cfapi_disconnect_sync_root(b.connKey)
+		C.cfapi_journal_close(cRoot)
+		C.cfapi_oplog_close(cRoot)
+		C.cfapi_index_close(cRoot)
 		b.connected = false
 	}
 
+	unregisterCfAPIRoot(b.rootID)
+
 	return nil
 }
 
+// populateTree hands the whole metadata tree to the shim's multi-threaded
+// populator in one flat blob; independent directories are created in
+// parallel and progress arrives as CFAPI_EVENT_POPULATE records. Falls back
+// to the single-threaded recursive path if the shim rejects the blob.
+func (b *CfAPIBackend) populateTree(tree *models.FileNode) {
+	blob := encodePopulateBlob(tree)
+	if blob == nil {
+		return
+	}
+
+	cRoot := C.CString(b.syncRoot)
+	defer C.free(unsafe.Pointer(cRoot))
+
+	var report C.cfapi_diff_report
+	hr := C.cfapi_populate_tree(cRoot, C.int(b.rootID),
+		unsafe.Pointer(&blob[0]), C.longlong(len(blob)),
+		C.int(runtime.NumCPU()), &report)
+	if hr != 0 {
+		logger.Error("Parallel population failed: HRESULT 0x%08x, using recursive fallback", uint32(hr))
+		b.createPlaceholdersRecursive(tree, b.syncRoot)
+		return
+	}
+	if report.failures > 0 {
+		logger.Error("Population: %d creates failed (first HRESULT 0x%08x)",
+			int(report.failures), uint32(report.first_error))
+	}
+	logger.Info("Populated %d placeholders", int(report.creates))
+}
+
 func (b *CfAPIBackend) createPlaceholdersRecursive(node *models.FileNode, localDir string) {
-	for _, child := range node.Children {
-		localPath := localDir + string(os.PathSeparator) + child.Name
+	b.createPlaceholdersBatch(localDir, node.Children)
 
-		cPath := C.CString(localDir)
-		cName := C.CString(child.Name)
-		cID := C.CString(child.ID)
-		isDir := C.int(0)
+	for _, child := range node.Children {
 		if child.IsDir {
-			isDir = 1
+			localPath := localDir + string(os.PathSeparator) + child.Name
+			os.MkdirAll(localPath, 0755)
+			b.createPlaceholdersRecursive(child, localPath)
 		}
+	}
+}
 
-		C.cfapi_create_placeholder(cPath, cName, cID,
-			C.longlong(child.Size), C.longlong(child.ModTime.Unix()), isDir)
+// createPlaceholdersBatch creates all placeholders for one directory with a
+// single CGO call (one CfCreatePlaceholders per directory instead of per file).
+func (b *CfAPIBackend) createPlaceholdersBatch(localDir string, children []*models.FileNode) {
+	n := len(children)
+	if n == 0 {
+		return
+	}
 
-		C.free(unsafe.Pointer(cPath))
-		C.free(unsafe.Pointer(cName))
-		C.free(unsafe.Pointer(cID))
+	cPath := C.CString(localDir)
+	defer C.free(unsafe.Pointer(cPath))
+
+	cEntries, freeEntries := makePlaceholderEntries(children)
+	defer freeEntries()
+
+	results := make([]C.long, n)
+	hr := C.cfapi_create_placeholders_batch(cPath, cEntries, C.int(n), &results[0])
+	if hr != 0 {
+		logger.Error("Batch placeholder creation failed for %s: HRESULT 0x%08x", localDir, uint32(hr))
+		return
+	}
+
+	for i, r := range results {
+		if r != 0 {
+			logger.Error("Placeholder creation failed for %s: HRESULT 0x%08x",
+				children[i].Name, uint32(r))
+		}
+	}
+}
 
+// makePlaceholderEntries builds a C array of placeholder descriptors for the
+// given nodes. The returned function frees the array and its strings.
+func makePlaceholderEntries(children []*models.FileNode) (*C.cfapi_placeholder_entry, func()) {
+	n := len(children)
+	entrySize := C.size_t(unsafe.Sizeof(C.cfapi_placeholder_entry{}))
+	cEntries := (*C.cfapi_placeholder_entry)(C.malloc(C.size_t(n) * entrySize))
+
+	entries := unsafe.Slice(cEntries, n)
+	for i, child := range children {
+		entries[i].name = C.CString(child.Name)
+		entries[i].file_identity = C.CString(fileIdentity(child))
+		entries[i].file_size = C.longlong(child.Size)
+		entries[i].mtime_unix = C.longlong(child.ModTime.Unix())
+		entries[i].is_directory = C.int(0)
 		if child.IsDir {
-			os.MkdirAll(localPath, 0755)
-			b.createPlaceholdersRecursive(child, localPath)
+			entries[i].is_directory = 1
+		}
+	}
+
+	return cEntries, func() {
+		for i := range entries {
+			C.free(unsafe.Pointer(entries[i].name))
+			C.free(unsafe.Pointer(entries[i].file_identity))
 		}
+		C.free(unsafe.Pointer(cEntries))
 	}
 }
 
+// PlaceholderIndexEntry is one record from the shim's persistent identity
+// index (see cfapi_index_open in cfapi_shim.h).
+type PlaceholderIndexEntry struct {
+	Path    string // relative to the sync root, '/'-separated
+	Size    int64
+	Version int
+	State   uint32
+}
+
+// IsDehydrated reports whether the indexed placeholder has no local content.
+func (e *PlaceholderIndexEntry) IsDehydrated() bool {
+	return e.State&0x1 != 0 // CFAPI_INDEX_STATE_DEHYDRATED
+}
+
+// LookupIdentity resolves a file identity through the shim's memory-mapped
+// index: one hash probe instead of a recursive metadata tree search, warm
+// across restarts.
+func (b *CfAPIBackend) LookupIdentity(fileID string) (PlaceholderIndexEntry, bool) {
+	cID := C.CString(fileID)
+	defer C.free(unsafe.Pointer(cID))
+
+	pathBuf := make([]C.char, 512)
+	var size C.longlong
+	var version C.int
+	var state C.uint
+
+	n := C.cfapi_lookup_identity(cID, C.int(len(fileID)),
+		&pathBuf[0], C.int(len(pathBuf)), &size, &version, &state)
+	if n != 1 {
+		return PlaceholderIndexEntry{}, false
+	}
+	return PlaceholderIndexEntry{
+		Path:    C.GoString(&pathBuf[0]),
+		Size:    int64(size),
+		Version: int(version),
+		State:   uint32(state),
+	}, true
+}
+
+// PlaceholderScanRecord describes one entry found by ScanPlaceholders.
+type PlaceholderScanRecord struct {
+	Path       string // relative to the sync root
+	State      uint32 // CF_PLACEHOLDER_STATE bits
+	Attributes uint32 // FILE_ATTRIBUTE_* bits
+	Size       int64
+	LastAccess time.Time
+}
+
+// IsHydrated reports whether the placeholder has its content on disk.
+func (r *PlaceholderScanRecord) IsHydrated() bool {
+	// CF_PLACEHOLDER_STATE_PARTIAL (0x10) means content is missing.
+	return r.State&0x10 == 0
+}
+
+// IsPinned reports whether the user chose "Always keep on this device".
+func (r *PlaceholderScanRecord) IsPinned() bool {
+	return r.Attributes&0x80000 != 0 // FILE_ATTRIBUTE_PINNED
+}
+
+// ScanPlaceholders walks the sync root with the shim's bulk enumerator and
+// invokes fn for every entry. Records arrive in large batches with one CGO
+// call each, so a full scan is metadata-I/O bound rather than CGO bound.
+// Returning false from fn stops the scan early.
+func (b *CfAPIBackend) ScanPlaceholders(fn func(rec PlaceholderScanRecord) bool) error {
+	const (
+		batchRecords = 4096
+		arenaSize    = 1 << 20
+	)
+
+	cRoot := C.CString(b.syncRoot)
+	defer C.free(unsafe.Pointer(cRoot))
+
+	scan := C.cfapi_scan_begin(cRoot)
+	if scan == nil {
+		return fmt.Errorf("cfapi_scan_begin failed")
+	}
+	defer C.cfapi_scan_end(scan)
+
+	records := make([]C.cfapi_scan_record, batchRecords)
+	arena := make([]byte, arenaSize)
+
+	for {
+		n := C.cfapi_scan_next(scan, &records[0], batchRecords,
+			(*C.char)(unsafe.Pointer(&arena[0])), arenaSize)
+		if n < 0 {
+			return fmt.Errorf("cfapi_scan_next failed")
+		}
+		if n == 0 {
+			return nil
+		}
+
+		for i := 0; i < int(n); i++ {
+			rec := &records[i]
+			path := string(arena[rec.path_offset : rec.path_offset+rec.path_len])
+			if !fn(PlaceholderScanRecord{
+				Path:       path,
+				State:      uint32(rec.state),
+				Attributes: uint32(rec.attributes),
+				Size:       int64(rec.size),
+				LastAccess: time.Unix(int64(rec.last_access_unix), 0),
+			}) {
+				return nil
+			}
+		}
+	}
+}
+
+// DehydrateBatch dehydrates the given placeholders (paths relative to the
+// sync root) with a single CGO call; the shim parallelizes the per-file
+// handle pipeline internally. Returns the entries that failed, keyed by
+// relative path, with their HRESULTs so callers can retry selectively.
+func (b *CfAPIBackend) DehydrateBatch(paths []string) map[string]uint32 {
+	n := len(paths)
+	if n == 0 {
+		return nil
+	}
+
+	ptrSize := C.size_t(unsafe.Sizeof((*C.char)(nil)))
+	cPaths := (**C.char)(C.malloc(C.size_t(n) * ptrSize))
+	defer C.free(unsafe.Pointer(cPaths))
+
+	entries := unsafe.Slice(cPaths, n)
+	for i, p := range paths {
+		entries[i] = C.CString(b.syncRoot + string(os.PathSeparator) + p)
+	}
+	defer func() {
+		for i := range entries {
+			C.free(unsafe.Pointer(entries[i]))
+		}
+	}()
+
+	results := make([]C.long, n)
+	if hr := C.cfapi_dehydrate_batch(cPaths, C.int(n), &results[0]); hr != 0 {
+		logger.Error("Batch dehydration failed: HRESULT 0x%08x", uint32(hr))
+		failed := make(map[string]uint32, n)
+		for _, p := range paths {
+			failed[p] = uint32(hr)
+		}
+		return failed
+	}
+
+	var failed map[string]uint32
+	for i, r := range results {
+		if r != 0 {
+			if failed == nil {
+				failed = make(map[string]uint32)
+			}
+			failed[paths[i]] = uint32(r)
+		}
+	}
+	return failed
+}
+
+// bulkProcessPriorityMap converts the FRUITSALADE_BULK_PROCESSES environment
+// variable ("pin-worker.exe,backup.exe") into the shim's priority map format.
+func bulkProcessPriorityMap() string {
+	var entries []string
+	for _, name := range strings.Split(os.Getenv("FRUITSALADE_BULK_PROCESSES"), ",") {
+		if name = strings.TrimSpace(name); name != "" {
+			entries = append(entries, name+"=bulk")
+		}
+	}
+	return strings.Join(entries, ";")
+}
+
+// hydrationPolicyFromEnv reads the admission-control knobs:
+//
+//	FRUITSALADE_HYDRATION_BPS          per-process refill, bytes/sec
+//	FRUITSALADE_HYDRATION_BURST        per-process burst, bytes
+//	FRUITSALADE_HYDRATION_MAX_INFLIGHT global in-flight ceiling, bytes
+//	FRUITSALADE_HYDRATION_PROCESS_BPS  per-image overrides, "img.exe=bytes,..."
+//
+// set is false when none are present, leaving admission control off.
+func hydrationPolicyFromEnv() (bps, burst, inflight int64, overrides string, set bool) {
+	parse := func(name string) int64 {
+		v := os.Getenv(name)
+		if v == "" {
+			return 0
+		}
+		n, err := strconv.ParseInt(v, 10, 64)
+		if err != nil || n < 0 {
+			logger.Error("Ignoring invalid %s=%q", name, v)
+			return 0
+		}
+		set = true
+		return n
+	}
+	bps = parse("FRUITSALADE_HYDRATION_BPS")
+	burst = parse("FRUITSALADE_HYDRATION_BURST")
+	inflight = parse("FRUITSALADE_HYDRATION_MAX_INFLIGHT")
+
+	var entries []string
+	for _, pair := range strings.Split(os.Getenv("FRUITSALADE_HYDRATION_PROCESS_BPS"), ",") {
+		if pair = strings.TrimSpace(pair); pair != "" {
+			entries = append(entries, pair)
+			set = true
+		}
+	}
+	overrides = strings.Join(entries, ";")
+	return
+}
+
+// prefetchHeadBytesFromEnv reads FRUITSALADE_PREFETCH_HEAD_KB, how much of
+// each file the enumeration prefetcher stages in the block cache when a
+// directory is browsed. Defaults to 64 KB; 0 disables prefetching.
+func prefetchHeadBytesFromEnv() int64 {
+	v := os.Getenv("FRUITSALADE_PREFETCH_HEAD_KB")
+	if v == "" {
+		return 64 << 10
+	}
+	n, err := strconv.ParseInt(v, 10, 64)
+	if err != nil || n < 0 {
+		logger.Error("Ignoring invalid FRUITSALADE_PREFETCH_HEAD_KB=%q", v)
+		return 64 << 10
+	}
+	return n << 10
+}
+
+// lazyPopulationEnabled reports whether on-demand directory population was
+// requested via the FRUITSALADE_LAZY_POPULATION environment variable.
+func lazyPopulationEnabled() bool {
+	switch os.Getenv("FRUITSALADE_LAZY_POPULATION") {
+	case "1", "true", "yes":
+		return true
+	}
+	return false
+}
+
 func (b *CfAPIBackend) watchMetadataChanges(ctx context.Context) {
 	for {
 		select {
@@ -165,74 +626,424 @@ func (b *CfAPIBackend) watchMetadataChanges(ctx context.Context) {
 			continue
 		}
 
-		for _, node := range diff.Added {
-			dir := b.syncRoot + string(os.PathSeparator) + dirOf(node.Path)
-			b.createPlaceholderSingle(dir, node)
+		// Hand the whole diff to the shim in one flat blob: one CGO
+		// transition and one kernel call per directory instead of a
+		// conversion and handle open per node.
+		if blob := encodeTreeDiff(diff); blob != nil {
+			cRoot := C.CString(b.syncRoot)
+			var report C.cfapi_diff_report
+			hr := C.cfapi_apply_tree_diff(cRoot, unsafe.Pointer(&blob[0]),
+				C.longlong(len(blob)), &report)
+			C.free(unsafe.Pointer(cRoot))
+			if hr != 0 {
+				logger.Error("Tree diff apply failed: HRESULT 0x%08x", uint32(hr))
+			} else if report.failures > 0 {
+				logger.Error("Tree diff: %d ops failed (first HRESULT 0x%08x)",
+					int(report.failures), uint32(report.first_error))
+			} else {
+				logger.Debug("Tree diff applied: %d creates, %d updates, %d deletes",
+					int(report.creates), int(report.updates), int(report.deletes))
+			}
 		}
 
-		for _, node := range diff.Changed {
-			localPath := b.syncRoot + string(os.PathSeparator) + node.Path
-			cPath := C.CString(localPath)
-			cID := C.CString(node.ID)
-			C.cfapi_update_placeholder(cPath, cID,
-				C.longlong(node.Size), C.longlong(node.ModTime.Unix()))
-			C.free(unsafe.Pointer(cPath))
-			C.free(unsafe.Pointer(cID))
+		// The refresh replaced the tree; drop interned path conversions so
+		// the shim's cache doesn't accumulate stale entries.
+		C.cfapi_intern_invalidate()
+	}
+}
+
+// pollShimEvents drains the shim's native event ring. NOTIFY and VALIDATE
+// callbacks are acknowledged inside the shim and buffered there, so Go pays
+// one CGO call per batch instead of one per filesystem event; local edits
+// are picked up from FILE_CLOSE events and pushed to the server. One poller
+// serves all connected roots; events for unregistered roots are dropped.
+func pollShimEvents() {
+	events := make([]C.cfapi_event, 256)
+	ticker := time.NewTicker(time.Second)
+	defer ticker.Stop()
+
+	for range ticker.C {
+		for {
+			n := C.cfapi_poll_events(&events[0], C.int(len(events)))
+			if n <= 0 {
+				break
+			}
+			for i := 0; i < int(n); i++ {
+				if b := lookupCfAPIRoot(events[i].root_id); b != nil {
+					b.handleShimEvent(context.Background(), &events[i])
+				}
+			}
+			if int(n) < len(events) {
+				break
+			}
 		}
+	}
+}
+
+// logShimStats periodically snapshots the shim's per-stage latency
+// histograms (queue wait, Go dispatch, CfExecute), transfer byte counts and
+// queue depths. The counters are cumulative, so each line is a complete
+// picture — one log line a minute turns "opening files is slow" reports into
+// a readable stage breakdown without attaching a profiler.
+func logShimStats() {
+	var buf [1024]C.char
+	ticker := time.NewTicker(time.Minute)
+	defer ticker.Stop()
 
-		// Removed files: the OS handles deletion via the sync root
+	for range ticker.C {
+		if hr := C.cfapi_get_stats(&buf[0], C.int(len(buf))); hr != 0 {
+			logger.Error("cfapi_get_stats failed: HRESULT 0x%08x", uint32(hr))
+			continue
+		}
+		logger.Info("Shim stats: %s", C.GoString(&buf[0]))
 	}
 }
 
-func (b *CfAPIBackend) createPlaceholderSingle(localDir string, node *models.FileNode) {
-	cPath := C.CString(localDir)
-	cName := C.CString(node.Name)
-	cID := C.CString(node.ID)
-	isDir := C.int(0)
-	if node.IsDir {
-		isDir = 1
-	}
-	C.cfapi_create_placeholder(cPath, cName, cID,
-		C.longlong(node.Size), C.longlong(node.ModTime.Unix()), isDir)
-	C.free(unsafe.Pointer(cPath))
-	C.free(unsafe.Pointer(cName))
-	C.free(unsafe.Pointer(cID))
+// eventPath converts a shim event path (sync-root-relative, backslashes) to
+// a metadata tree path ("/docs/readme.txt").
+func eventPath(p *C.char) string {
+	rel := strings.ReplaceAll(C.GoString(p), "\\", "/")
+	return "/" + rel
 }
 
-func dirOf(path string) string {
-	for i := len(path) - 1; i >= 0; i-- {
-		if path[i] == '/' {
-			if i == 0 {
-				return ""
+func (b *CfAPIBackend) handleShimEvent(ctx context.Context, ev *C.cfapi_event) {
+	switch ev._type {
+	case C.CFAPI_EVENT_RENAME:
+		logger.Debug("Local rename: %s -> %s",
+			eventPath(&ev.path[0]), eventPath(&ev.target_path[0]))
+	case C.CFAPI_EVENT_DELETE:
+		logger.Debug("Local delete: %s", eventPath(&ev.path[0]))
+	case C.CFAPI_EVENT_FILE_CLOSE:
+		b.uploadIfChanged(ctx, C.GoString(&ev.path[0]))
+	case C.CFAPI_EVENT_VALIDATE:
+		logger.Debug("Validate request: %s (%d bytes)",
+			eventPath(&ev.path[0]), int64(ev.size))
+	case C.CFAPI_EVENT_PIN:
+		// The shim hydrates the pinned subtree itself; this is visibility.
+		logger.Info("Pinned: %s (bulk hydration started)", eventPath(&ev.path[0]))
+	case C.CFAPI_EVENT_UNPIN:
+		logger.Info("Unpinned: %s", eventPath(&ev.path[0]))
+	case C.CFAPI_EVENT_READY:
+		logger.Info("Sync root connected and serving callbacks")
+	case C.CFAPI_EVENT_POPULATE:
+		logger.Info("Population progress: %d placeholders created", int64(ev.size))
+	}
+}
+
+// uploadIfChanged uploads a file if its size or mtime diverged from the
+// metadata tree, serving both close events and journal drains. Hydrations
+// also close handles and trip the root watcher, but they leave size and
+// mtime matching the tree, so they are filtered out here. Returns whether
+// the local file now matches the server (already clean, gone, or uploaded);
+// false means the upload failed and the caller should not confirm it.
+func (b *CfAPIBackend) uploadIfChanged(ctx context.Context, relPath string) bool {
+	if relPath == "" {
+		return false
+	}
+	node := b.core.FindByPath("/" + strings.ReplaceAll(relPath, "\\", "/"))
+	if node == nil || node.IsDir {
+		return node != nil
+	}
+
+	localPath := b.syncRoot + string(os.PathSeparator) + relPath
+	info, err := os.Stat(localPath)
+	if err != nil || info.IsDir() {
+		return true // deleted or replaced by a directory; nothing to upload
+	}
+	if info.Size() == node.Size && !info.ModTime().After(node.ModTime) {
+		return true
+	}
+
+	serverPath := strings.TrimPrefix(node.Path, "/")
+	resp, err := b.core.UploadFile(ctx, serverPath, localPath, node.Version)
+	if err != nil {
+		logger.Error("Upload of local edit failed for %s: %v", node.Path, err)
+		return false
+	}
+	b.core.UpdateMetadataNode(node.Path, resp.Size, resp.Hash, time.Now(), resp.Version)
+	logger.Info("Uploaded local edit: %s (%d bytes, v%d)", node.Path, resp.Size, resp.Version)
+	return true
+}
+
+// drainDirtyJournals periodically pulls modified-file records out of the
+// shim's write-back journals and uploads them. The shim coalesces repeated
+// saves of one file into a single record, and a record is only cleared once
+// cfapi_set_in_sync confirms the upload, so an edit made just before a crash
+// is drained again on the next start instead of silently lost. One drainer
+// serves all connected roots; records are routed back by root ID.
+func drainDirtyJournals() {
+	records := make([]C.cfapi_dirty_record, 64)
+	ticker := time.NewTicker(5 * time.Second)
+	defer ticker.Stop()
+
+	for range ticker.C {
+		n := C.cfapi_drain_dirty(&records[0], C.int(len(records)))
+		for i := 0; i < int(n); i++ {
+			rec := &records[i]
+			b := lookupCfAPIRoot(rec.root_id)
+			if b == nil {
+				continue
 			}
-			return path[1:i] // strip leading /
+			b.syncDirtyFile(context.Background(), C.GoString(&rec.path[0]))
+		}
+	}
+}
+
+// syncDirtyFile uploads one journaled file and, on success, flips its
+// placeholder in sync and clears the journal record. A failed upload leaves
+// the record in place; the journal hands it out again on a later drain.
+func (b *CfAPIBackend) syncDirtyFile(ctx context.Context, relPath string) {
+	if !b.uploadIfChanged(ctx, strings.ReplaceAll(relPath, "/", "\\")) {
+		return
+	}
+	cPath := C.CString(b.syncRoot + string(os.PathSeparator) + filepath.FromSlash(relPath))
+	if hr := C.cfapi_set_in_sync(cPath); hr != 0 {
+		logger.Error("In-sync confirmation failed for %s: HRESULT 0x%08x", relPath, uint32(hr))
+	}
+	C.free(unsafe.Pointer(cPath))
+}
+
+// hydrationChunkSize is how much of the HTTP body we read per transfer chunk.
+// The shim coalesces chunks into its own 1MB-aligned buffer, so this bounds
+// Go-side memory per hydration rather than CfExecute granularity.
+const hydrationChunkSize = 1 << 20
+
+//export goFetchPlaceholdersCallbackForRoot
+func goFetchPlaceholdersCallbackForRoot(rootID C.int,
+	dirIdentity *C.char, dirIdentityLen C.int,
+	transferKey C.CF_TRANSFER_KEY, connKey C.CF_CONNECTION_KEY) {
+
+	b := lookupCfAPIRoot(rootID)
+	if b == nil || b.core == nil {
+		C.cfapi_fetch_placeholders_complete(connKey, transferKey, nil, 0,
+			C.long(0x80004005)) // E_FAIL
+		return
+	}
+
+	// The sync root itself carries no identity; it maps to the tree root.
+	var node *models.FileNode
+	if dirIdentityLen == 0 {
+		node = b.core.Metadata()
+	} else {
+		id := C.GoStringN(dirIdentity, dirIdentityLen)
+		// Fast path: the placeholder index gives the directory's path, and
+		// resolving a path only walks its components; fall back to the
+		// recursive ID search when the index has no entry.
+		if entry, ok := b.LookupIdentity(id); ok {
+			node = b.core.FindByPath("/" + entry.Path)
+		}
+		if node == nil {
+			node = b.core.FindByID(identityFileID(id))
+		}
+	}
+	if node == nil {
+		C.cfapi_fetch_placeholders_complete(connKey, transferKey, nil, 0,
+			C.long(0x80004005))
+		return
+	}
+
+	if len(node.Children) == 0 {
+		C.cfapi_fetch_placeholders_complete(connKey, transferKey, nil, 0, 0)
+		return
+	}
+
+	cEntries, freeEntries := makePlaceholderEntries(node.Children)
+	defer freeEntries()
+
+	hr := C.cfapi_fetch_placeholders_complete(connKey, transferKey,
+		cEntries, C.int(len(node.Children)), 0)
+	if hr != 0 {
+		logger.Error("On-demand population failed for %s: HRESULT 0x%08x",
+			node.Path, uint32(hr))
+	}
+}
+
+//export goPrefetchHeadersCallbackForRoot
+func goPrefetchHeadersCallbackForRoot(rootID C.int,
+	dirIdentity *C.char, dirIdentityLen C.int) {
+
+	b := lookupCfAPIRoot(rootID)
+	if b == nil || b.core == nil || b.prefetchHeadBytes <= 0 {
+		return
+	}
+
+	// Copy the identity before returning: the shim's callback buffer is
+	// only valid for the duration of this call, and the fetch must not
+	// block the CfAPI callback thread.
+	id := C.GoStringN(dirIdentity, dirIdentityLen)
+	go b.prefetchDirHeaders(id)
+}
+
+// prefetchMaxFiles bounds one prefetch batch to roughly an Explorer window
+// of thumbnails; it also matches the server's per-batch cap.
+const prefetchMaxFiles = 256
+
+// prefetchDirHeaders fetches the leading bytes of every file in a directory
+// in one server round trip and stages them in the shim's block cache, so the
+// per-file FETCH_DATA storm that follows an Explorer enumeration is served
+// locally. Best-effort: any failure just leaves the reads to hydrate from
+// the server as before.
+func (b *CfAPIBackend) prefetchDirHeaders(dirIdentity string) {
+	// The sync root carries no identity; it maps to the tree root.
+	var node *models.FileNode
+	if dirIdentity == "" {
+		node = b.core.Metadata()
+	} else {
+		if entry, ok := b.LookupIdentity(dirIdentity); ok {
+			node = b.core.FindByPath("/" + entry.Path)
+		}
+		if node == nil {
+			node = b.core.FindByID(identityFileID(dirIdentity))
+		}
+	}
+	if node == nil || !node.IsDir {
+		return
+	}
+
+	var ids []string
+	byID := make(map[string]*models.FileNode)
+	for _, child := range node.Children {
+		if child.IsDir || child.Size <= 0 {
+			continue
+		}
+		serverID := strings.TrimPrefix(child.ID, "/")
+		ids = append(ids, child.ID)
+		byID[serverID] = child
+		if len(ids) == prefetchMaxFiles {
+			break
 		}
 	}
-	return ""
+	if len(ids) == 0 {
+		return
+	}
+
+	ctx, cancel := context.WithTimeout(context.Background(), 30*time.Second)
+	defer cancel()
+
+	heads, err := b.core.FetchContentHeads(ctx, ids, b.prefetchHeadBytes)
+	if err != nil {
+		logger.Debug("Header prefetch for %s failed: %v", node.Path, err)
+		return
+	}
+
+	var staged int
+	for _, head := range heads {
+		child := byID[head.FileID]
+		if child == nil || len(head.Data) == 0 {
+			continue
+		}
+		identity := fileIdentity(child)
+		cIdentity := C.CString(identity)
+		hr := C.cfapi_stage_header(cIdentity, C.int(len(identity)),
+			unsafe.Pointer(&head.Data[0]), C.longlong(len(head.Data)))
+		C.free(unsafe.Pointer(cIdentity))
+		if hr == 0 {
+			staged++
+		}
+	}
+	logger.Debug("Prefetched %d/%d file heads for %s", staged, len(ids), node.Path)
 }
 
-//export goHydrationCallback
-func goHydrationCallback(fileIdentity *C.char, fileIdentityLen C.int,
+//export goHydrationCallbackForRoot
+func goHydrationCallbackForRoot(rootID C.int,
+	fileIdentity *C.char, fileIdentityLen C.int,
 	offset C.longlong, length C.longlong,
 	transferKey C.CF_TRANSFER_KEY) {
 
-	if globalCfAPIBackend == nil || globalCfAPIBackend.core == nil {
-		C.cfapi_transfer_error(globalCfAPIBackend.connKey, transferKey,
-			C.longlong(offset), C.long(0x80004005)) // E_FAIL
+	b := lookupCfAPIRoot(rootID)
+	if b == nil || b.core == nil {
+		// No connection key to report the error on; CfAPI times the
+		// request out once the root is gone.
 		return
 	}
 
-	fileID := C.GoStringN(fileIdentity, fileIdentityLen)
-	ctx := context.Background()
+	fileID := identityFileID(C.GoStringN(fileIdentity, fileIdentityLen))
 
-	data, err := globalCfAPIBackend.core.FetchContentRange(ctx, fileID, int64(offset), int64(length))
+	// Register a cancellable context for the transfer so the shim's cancel
+	// callback can abort the download mid-stream; chunk commits for a
+	// cancelled key also fail fast with E_ABORT inside the shim.
+	ctx, cancelHydration := context.WithCancel(context.Background())
+	key := hydrationKey{int64(b.connKey), transferKeyValue(transferKey)}
+	hydrationCancelMu.Lock()
+	hydrationCancels[key] = cancelHydration
+	hydrationCancelMu.Unlock()
+	defer func() {
+		hydrationCancelMu.Lock()
+		delete(hydrationCancels, key)
+		hydrationCancelMu.Unlock()
+		cancelHydration()
+	}()
+
+	session := C.cfapi_transfer_begin(b.connKey, transferKey, fileIdentity, fileIdentityLen)
+	if session == nil {
+		C.cfapi_transfer_error(b.connKey, transferKey,
+			C.longlong(offset), C.long(0x8007000E)) // E_OUTOFMEMORY
+		return
+	}
+
+	reader, err := b.core.FetchContentStream(ctx, fileID, int64(offset), int64(length))
 	if err != nil {
+		if ctx.Err() != nil {
+			logger.Debug("Hydration cancelled for %s", fileID)
+			C.cfapi_transfer_end(session, C.long(0x80004004)) // E_ABORT
+			return
+		}
 		logger.Error("Hydration failed for %s: %v", fileID, err)
-		C.cfapi_transfer_error(globalCfAPIBackend.connKey, transferKey,
-			C.longlong(offset), C.long(0x80004005))
+		C.cfapi_transfer_end(session, C.long(0x80004005))
+		return
+	}
+	defer reader.Close()
+
+	// Read the response body directly into a shim-owned, page-aligned buffer
+	// and commit it in place: the bytes CfExecute consumes are the bytes the
+	// network wrote, with no CGO copy or Go-heap staging in between.
+	var bufPtr unsafe.Pointer
+	if hr := C.cfapi_acquire_buffer(session, C.longlong(hydrationChunkSize), &bufPtr); hr != 0 {
+		logger.Error("Buffer acquisition failed for %s: HRESULT 0x%08x", fileID, uint32(hr))
+		C.cfapi_transfer_end(session, C.long(hr))
+		return
+	}
+	buf := unsafe.Slice((*byte)(bufPtr), hydrationChunkSize)
+	pos := int64(offset)
+	var transferred int64
+
+	for {
+		n, readErr := reader.Read(buf)
+		if n > 0 {
+			hr := C.cfapi_commit_buffer(session, bufPtr,
+				C.longlong(pos), C.longlong(n))
+			if hr != 0 {
+				if ctx.Err() != nil || uint32(hr) == 0x80004004 { // E_ABORT
+					logger.Debug("Hydration cancelled for %s after %d bytes", fileID, transferred)
+					C.cfapi_transfer_end(session, C.long(0x80004004))
+					return
+				}
+				logger.Error("Transfer chunk failed for %s: HRESULT 0x%08x", fileID, uint32(hr))
+				C.cfapi_transfer_end(session, C.long(0x80004005))
+				return
+			}
+			pos += int64(n)
+			transferred += int64(n)
+		}
+		if readErr == io.EOF {
+			break
+		}
+		if readErr != nil {
+			if ctx.Err() != nil {
+				logger.Debug("Hydration cancelled for %s after %d bytes", fileID, transferred)
+				C.cfapi_transfer_end(session, C.long(0x80004004)) // E_ABORT
+				return
+			}
+			logger.Error("Hydration read failed for %s: %v", fileID, readErr)
+			C.cfapi_transfer_end(session, C.long(0x80004005))
+			return
+		}
+	}
+
+	if hr := C.cfapi_transfer_end(session, 0); hr != 0 {
+		logger.Error("Transfer completion failed for %s: HRESULT 0x%08x", fileID, uint32(hr))
 		return
 	}
 
-	C.cfapi_transfer_data(globalCfAPIBackend.connKey, transferKey,
-		unsafe.Pointer(&data[0]), C.longlong(offset), C.longlong(len(data)))
+	b.core.Stats.BytesDownloaded.Add(transferred)
 }
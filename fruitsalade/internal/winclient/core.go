@@ -262,6 +262,54 @@ func (c *ClientCore) FetchContentRange(ctx context.Context, fileID string, offse
 	return data, nil
 }
 
+// FetchContentStream returns a reader over a byte range of a file's content,
+// letting callers stream large hydrations without buffering the whole range.
+// The caller must close the returned reader.
+func (c *ClientCore) FetchContentStream(ctx context.Context, fileID string, offset, length int64) (io.ReadCloser, error) {
+	if !c.Client.IsOnline() {
+		c.Stats.OfflineErrors.Add(1)
+		return nil, fmt.Errorf("server offline")
+	}
+
+	serverID := strings.TrimPrefix(fileID, "/")
+
+	reader, _, err := c.Client.FetchContent(ctx, serverID, offset, length)
+	if err != nil {
+		c.Stats.FailedFetches.Add(1)
+		return nil, err
+	}
+
+	c.Stats.RangeReads.Add(1)
+	return reader, nil
+}
+
+// FetchContentHeads fetches the leading bytes of several files in one server
+// round trip, used to warm local caches ahead of a predictable read storm.
+// Files the server could not serve are absent from the result.
+func (c *ClientCore) FetchContentHeads(ctx context.Context, fileIDs []string, length int64) ([]client.HeadResult, error) {
+	if !c.Client.IsOnline() {
+		c.Stats.OfflineErrors.Add(1)
+		return nil, fmt.Errorf("server offline")
+	}
+
+	serverIDs := make([]string, len(fileIDs))
+	for i, id := range fileIDs {
+		serverIDs[i] = strings.TrimPrefix(id, "/")
+	}
+
+	heads, err := c.Client.FetchContentHeads(ctx, serverIDs, length)
+	if err != nil {
+		c.Stats.FailedFetches.Add(1)
+		return nil, err
+	}
+
+	c.Stats.RangeReads.Add(1)
+	for _, head := range heads {
+		c.Stats.BytesDownloaded.Add(int64(len(head.Data)))
+	}
+	return heads, nil
+}
+
 // UploadFile uploads a local file to the server.
 func (c *ClientCore) UploadFile(ctx context.Context, serverPath, localPath string, expectedVersion int) (*client.UploadResponse, error) {
 	f, err := os.Open(localPath)
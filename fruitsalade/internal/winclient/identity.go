@@ -0,0 +1,36 @@
+package winclient
+
+import (
+	"strings"
+
+	"github.com/fruitsalade/fruitsalade/shared/pkg/models"
+)
+
+// File identity blobs are the opaque bytes stored on every placeholder and
+// echoed back by CfAPI callbacks. Version 1 blobs are the bare node ID.
+// Version 2 ("FSI2|<id>|<sha256-hex>") additionally carries the server's
+// content hash from the metadata tree, which lets the shim answer
+// VALIDATE_DATA requests by hashing local bytes instead of treating every
+// integrity check as a server round trip. Blobs without the prefix parse
+// as v1, so placeholders created before the upgrade keep working.
+const identityV2Prefix = "FSI2|"
+
+// fileIdentity builds the identity blob for a node. Directories and nodes
+// the server has no hash for get plain v1 IDs.
+func fileIdentity(node *models.FileNode) string {
+	if node.IsDir || node.Hash == "" {
+		return node.ID
+	}
+	return identityV2Prefix + node.ID + "|" + node.Hash
+}
+
+// identityFileID extracts the node ID from an identity blob of any version.
+func identityFileID(identity string) string {
+	if strings.HasPrefix(identity, identityV2Prefix) {
+		rest := identity[len(identityV2Prefix):]
+		if i := strings.LastIndex(rest, "|"); i >= 0 {
+			return rest[:i]
+		}
+	}
+	return identity
+}
@@ -0,0 +1,42 @@
+package winclient
+
+import (
+	"testing"
+	"time"
+
+	"github.com/fruitsalade/fruitsalade/shared/pkg/models"
+)
+
+func TestFileIdentityRoundTrip(t *testing.T) {
+	now := time.Now()
+	cases := []struct {
+		node     *models.FileNode
+		wantBlob string
+	}{
+		{&models.FileNode{ID: "f1", Hash: "abc123", ModTime: now},
+			"FSI2|f1|abc123"},
+		{&models.FileNode{ID: "f2", ModTime: now}, "f2"}, // no hash: v1
+		{&models.FileNode{ID: "d1", Hash: "abc123", IsDir: true, ModTime: now},
+			"d1"}, // directories: v1
+	}
+
+	for _, tc := range cases {
+		blob := fileIdentity(tc.node)
+		if blob != tc.wantBlob {
+			t.Errorf("fileIdentity(%s) = %q, want %q", tc.node.ID, blob, tc.wantBlob)
+		}
+		if got := identityFileID(blob); got != tc.node.ID {
+			t.Errorf("identityFileID(%q) = %q, want %q", blob, got, tc.node.ID)
+		}
+	}
+}
+
+func TestIdentityFileIDPassthrough(t *testing.T) {
+	// Pre-upgrade blobs and IDs that happen to contain separators must
+	// come back unchanged.
+	for _, id := range []string{"plain-id", "id|with|pipes", ""} {
+		if got := identityFileID(id); got != id {
+			t.Errorf("identityFileID(%q) = %q, want unchanged", id, got)
+		}
+	}
+}
@@ -0,0 +1,148 @@
+package winclient
+
+import (
+	"encoding/binary"
+	"sort"
+	"strings"
+
+	"github.com/fruitsalade/fruitsalade/shared/pkg/models"
+)
+
+// Flat binary diff format consumed by the shim's cfapi_apply_tree_diff.
+// One blob carries a whole MetadataDiff so a 50k-node diff costs one CGO
+// transition instead of one per node. Layout (little-endian):
+//
+//	offset 0   u32 magic 'FSD1'
+//	offset 4   u32 op count
+//	offset 8   u32 arena offset (from blob start)
+//	offset 12  u32 arena length
+//	offset 16  op count * 40-byte records (see writeDiffOp)
+//	arena      UTF-8 strings referenced by the records
+//
+// The record layout must stay in sync with cfapi_diff_op in cfapi_shim.h.
+const (
+	diffMagic     = 0x31445346 // 'FSD1'
+	diffHeaderLen = 16
+	diffOpLen     = 40
+
+	diffOpCreate = 0
+	diffOpUpdate = 1
+	diffOpDelete = 2
+)
+
+// encodeTreeDiff serializes a metadata diff for cfapi_apply_tree_diff.
+// Creates are emitted parent-first and deletes child-first, so the shim can
+// apply records in order; consecutive creates under one parent directory
+// stay adjacent and collapse into a single CfCreatePlaceholders call.
+// Returns nil for a nil or empty diff.
+func encodeTreeDiff(diff *MetadataDiff) []byte {
+	if diff == nil {
+		return nil
+	}
+
+	added := sortedByPath(diff.Added, false)
+	changed := sortedByPath(diff.Changed, false)
+	removed := sortedByPath(diff.Removed, true) // children before parents
+
+	count := len(added) + len(changed) + len(removed)
+	if count == 0 {
+		return nil
+	}
+
+	ops := make([]byte, 0, count*diffOpLen)
+	var arena []byte
+
+	for _, node := range added {
+		ops, arena = writeDiffOp(ops, arena, diffOpCreate, node, true)
+	}
+	for _, node := range changed {
+		ops, arena = writeDiffOp(ops, arena, diffOpUpdate, node, true)
+	}
+	for _, node := range removed {
+		ops, arena = writeDiffOp(ops, arena, diffOpDelete, node, false)
+	}
+
+	// Root-path entries are filtered out inside writeDiffOp.
+	count = len(ops) / diffOpLen
+	if count == 0 {
+		return nil
+	}
+
+	blob := make([]byte, 0, diffHeaderLen+len(ops)+len(arena))
+	blob = binary.LittleEndian.AppendUint32(blob, diffMagic)
+	blob = binary.LittleEndian.AppendUint32(blob, uint32(count))
+	blob = binary.LittleEndian.AppendUint32(blob, uint32(diffHeaderLen+len(ops)))
+	blob = binary.LittleEndian.AppendUint32(blob, uint32(len(arena)))
+	blob = append(blob, ops...)
+	blob = append(blob, arena...)
+	return blob
+}
+
+// encodePopulateBlob serializes every node under root as creates for
+// cfapi_populate_tree. Reuses the diff encoding: path-sorted creates are
+// parent-first, which is exactly the ordering the populator's task graph
+// needs. Returns nil for an empty tree.
+func encodePopulateBlob(root *models.FileNode) []byte {
+	if root == nil {
+		return nil
+	}
+	var nodes []*models.FileNode
+	var walk func(n *models.FileNode)
+	walk = func(n *models.FileNode) {
+		for _, child := range n.Children {
+			nodes = append(nodes, child)
+			if child.IsDir {
+				walk(child)
+			}
+		}
+	}
+	walk(root)
+	return encodeTreeDiff(&MetadataDiff{Added: nodes})
+}
+
+// writeDiffOp appends one record to ops and its strings to the arena.
+// withIdentity is false for deletes, which only need the path.
+func writeDiffOp(ops, arena []byte, kind int32, node *models.FileNode, withIdentity bool) ([]byte, []byte) {
+	relPath := strings.TrimPrefix(node.Path, "/")
+	if relPath == "" {
+		return ops, arena // never touch the sync root itself
+	}
+
+	pathOffset := len(arena)
+	arena = append(arena, relPath...)
+
+	identityOffset, identityLen := 0, 0
+	if withIdentity {
+		identity := fileIdentity(node)
+		identityOffset = len(arena)
+		identityLen = len(identity)
+		arena = append(arena, identity...)
+	}
+
+	isDir := int32(0)
+	if node.IsDir {
+		isDir = 1
+	}
+
+	ops = binary.LittleEndian.AppendUint32(ops, uint32(kind))
+	ops = binary.LittleEndian.AppendUint32(ops, uint32(isDir))
+	ops = binary.LittleEndian.AppendUint32(ops, uint32(pathOffset))
+	ops = binary.LittleEndian.AppendUint32(ops, uint32(len(relPath)))
+	ops = binary.LittleEndian.AppendUint32(ops, uint32(identityOffset))
+	ops = binary.LittleEndian.AppendUint32(ops, uint32(identityLen))
+	ops = binary.LittleEndian.AppendUint64(ops, uint64(node.Size))
+	ops = binary.LittleEndian.AppendUint64(ops, uint64(node.ModTime.Unix()))
+	return ops, arena
+}
+
+// sortedByPath returns a sorted copy; reverse puts deeper paths first.
+func sortedByPath(nodes []*models.FileNode, reverse bool) []*models.FileNode {
+	out := append([]*models.FileNode(nil), nodes...)
+	sort.Slice(out, func(i, j int) bool {
+		if reverse {
+			return out[i].Path > out[j].Path
+		}
+		return out[i].Path < out[j].Path
+	})
+	return out
+}
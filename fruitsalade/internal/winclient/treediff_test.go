@@ -0,0 +1,156 @@
+package winclient
+
+import (
+	"encoding/binary"
+	"testing"
+	"time"
+
+	"github.com/fruitsalade/fruitsalade/shared/pkg/models"
+)
+
+// decodedDiffOp mirrors cfapi_diff_op with its strings resolved.
+type decodedDiffOp struct {
+	kind     int
+	isDir    bool
+	path     string
+	identity string
+	size     int64
+	mtime    int64
+}
+
+func decodeTreeDiff(t *testing.T, blob []byte) []decodedDiffOp {
+	t.Helper()
+	if len(blob) < diffHeaderLen {
+		t.Fatalf("blob too short: %d bytes", len(blob))
+	}
+	if magic := binary.LittleEndian.Uint32(blob); magic != diffMagic {
+		t.Fatalf("magic = 0x%08x, want 0x%08x", magic, diffMagic)
+	}
+	count := int(binary.LittleEndian.Uint32(blob[4:]))
+	arenaOffset := int(binary.LittleEndian.Uint32(blob[8:]))
+	arenaLen := int(binary.LittleEndian.Uint32(blob[12:]))
+	if arenaOffset != diffHeaderLen+count*diffOpLen {
+		t.Fatalf("arena offset = %d, want %d", arenaOffset, diffHeaderLen+count*diffOpLen)
+	}
+	if arenaOffset+arenaLen != len(blob) {
+		t.Fatalf("blob length = %d, header says %d", len(blob), arenaOffset+arenaLen)
+	}
+	arena := blob[arenaOffset:]
+
+	ops := make([]decodedDiffOp, count)
+	for i := range ops {
+		rec := blob[diffHeaderLen+i*diffOpLen:]
+		pathOff := binary.LittleEndian.Uint32(rec[8:])
+		pathLen := binary.LittleEndian.Uint32(rec[12:])
+		idOff := binary.LittleEndian.Uint32(rec[16:])
+		idLen := binary.LittleEndian.Uint32(rec[20:])
+		ops[i] = decodedDiffOp{
+			kind:     int(binary.LittleEndian.Uint32(rec)),
+			isDir:    binary.LittleEndian.Uint32(rec[4:]) == 1,
+			path:     string(arena[pathOff : pathOff+pathLen]),
+			identity: string(arena[idOff : idOff+idLen]),
+			size:     int64(binary.LittleEndian.Uint64(rec[24:])),
+			mtime:    int64(binary.LittleEndian.Uint64(rec[32:])),
+		}
+	}
+	return ops
+}
+
+func TestEncodeTreeDiff(t *testing.T) {
+	now := time.Unix(1700000000, 0)
+
+	diff := &MetadataDiff{
+		Added: []*models.FileNode{
+			{ID: "f2", Path: "/docs/new/b.txt", Size: 20, ModTime: now},
+			{ID: "d1", Path: "/docs/new", IsDir: true, ModTime: now},
+			{ID: "f1", Path: "/docs/new/a.txt", Size: 10, ModTime: now},
+		},
+		Changed: []*models.FileNode{
+			{ID: "f3", Path: "/readme.txt", Size: 99, ModTime: now},
+		},
+		Removed: []*models.FileNode{
+			{ID: "d2", Path: "/old", IsDir: true},
+			{ID: "f4", Path: "/old/gone.txt"},
+		},
+	}
+
+	ops := decodeTreeDiff(t, encodeTreeDiff(diff))
+	if len(ops) != 6 {
+		t.Fatalf("op count = %d, want 6", len(ops))
+	}
+
+	// Creates come first, parents before children.
+	wantCreates := []string{"docs/new", "docs/new/a.txt", "docs/new/b.txt"}
+	for i, want := range wantCreates {
+		if ops[i].kind != diffOpCreate || ops[i].path != want {
+			t.Errorf("op[%d] = kind %d path %q, want create %q", i, ops[i].kind, ops[i].path, want)
+		}
+	}
+	if !ops[0].isDir {
+		t.Error("docs/new should be a directory create")
+	}
+	if ops[1].identity != "f1" || ops[1].size != 10 || ops[1].mtime != now.Unix() {
+		t.Errorf("op[1] = %+v, want identity f1, size 10", ops[1])
+	}
+
+	if ops[3].kind != diffOpUpdate || ops[3].path != "readme.txt" || ops[3].identity != "f3" {
+		t.Errorf("op[3] = %+v, want update readme.txt", ops[3])
+	}
+
+	// Deletes come last, children before parents, no identity.
+	if ops[4].kind != diffOpDelete || ops[4].path != "old/gone.txt" || ops[4].identity != "" {
+		t.Errorf("op[4] = %+v, want delete old/gone.txt", ops[4])
+	}
+	if ops[5].kind != diffOpDelete || ops[5].path != "old" || !ops[5].isDir {
+		t.Errorf("op[5] = %+v, want directory delete old", ops[5])
+	}
+}
+
+func TestEncodePopulateBlob(t *testing.T) {
+	now := time.Unix(1700000000, 0)
+
+	tree := &models.FileNode{
+		Path: "/", IsDir: true,
+		Children: []*models.FileNode{
+			{ID: "f1", Path: "/readme.txt", Size: 5, ModTime: now},
+			{ID: "d1", Path: "/docs", IsDir: true, ModTime: now,
+				Children: []*models.FileNode{
+					{ID: "f2", Path: "/docs/a.txt", Size: 10, ModTime: now},
+				}},
+		},
+	}
+
+	ops := decodeTreeDiff(t, encodePopulateBlob(tree))
+	if len(ops) != 3 {
+		t.Fatalf("op count = %d, want 3", len(ops))
+	}
+	// All creates, sorted by path so parents precede their children.
+	wantPaths := []string{"docs", "docs/a.txt", "readme.txt"}
+	for i, want := range wantPaths {
+		if ops[i].kind != diffOpCreate || ops[i].path != want {
+			t.Errorf("op[%d] = kind %d path %q, want create %q", i, ops[i].kind, ops[i].path, want)
+		}
+	}
+
+	if blob := encodePopulateBlob(nil); blob != nil {
+		t.Errorf("nil tree: blob = %d bytes, want nil", len(blob))
+	}
+	if blob := encodePopulateBlob(&models.FileNode{Path: "/", IsDir: true}); blob != nil {
+		t.Errorf("childless tree: blob = %d bytes, want nil", len(blob))
+	}
+}
+
+func TestEncodeTreeDiffEmpty(t *testing.T) {
+	if blob := encodeTreeDiff(nil); blob != nil {
+		t.Errorf("nil diff: blob = %d bytes, want nil", len(blob))
+	}
+	if blob := encodeTreeDiff(&MetadataDiff{}); blob != nil {
+		t.Errorf("empty diff: blob = %d bytes, want nil", len(blob))
+	}
+
+	// A diff touching only the root encodes to nothing.
+	diff := &MetadataDiff{Changed: []*models.FileNode{{Path: "/", IsDir: true}}}
+	if blob := encodeTreeDiff(diff); blob != nil {
+		t.Errorf("root-only diff: blob = %d bytes, want nil", len(blob))
+	}
+}
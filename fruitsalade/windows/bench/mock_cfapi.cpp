@@ -0,0 +1,265 @@
+/*
+ * mock_cfapi.cpp - mock implementations of the CfAPI entry points the shim
+ * uses. See mock_cfapi.h for the control surface.
+ */
+
+#include "mock_cfapi.h"
+
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+namespace {
+
+std::atomic<int> s_executeLatencyUs{0};
+std::atomic<int> s_createLatencyUs{0};
+
+std::atomic<long long> s_executeCalls{0};
+std::atomic<long long> s_bytesTransferred{0};
+std::atomic<long long> s_placeholdersCreated{0};
+
+// Callback table and context captured per connection so the harness can
+// fire synthetic callbacks through the same path the driver would.
+struct MockConnection {
+    const CF_CALLBACK_REGISTRATION *table = nullptr;
+    LPCVOID context = nullptr;
+};
+
+std::mutex s_connMutex;
+std::unordered_map<long long, MockConnection> s_conns;
+long long s_nextConnKey = 1;
+
+// Busy-wait so sub-millisecond latencies are accurate; Sleep() granularity
+// would round everything up to a scheduler quantum.
+void BurnUs(int us) {
+    if (us <= 0) return;
+    LARGE_INTEGER freq, start, now;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&start);
+    long long ticks = freq.QuadPart * us / 1000000;
+    do {
+        QueryPerformanceCounter(&now);
+    } while (now.QuadPart - start.QuadPart < ticks);
+}
+
+const CF_CALLBACK_REGISTRATION *FindCallback(const MockConnection &conn,
+                                             CF_CALLBACK_TYPE type) {
+    for (const CF_CALLBACK_REGISTRATION *reg = conn.table;
+         reg && reg->Type != CF_CALLBACK_TYPE_NONE; reg++) {
+        if (reg->Type == type) return reg;
+    }
+    return nullptr;
+}
+
+} /* namespace */
+
+void MockCfSetLatencyUs(int execute_us, int create_us) {
+    s_executeLatencyUs.store(execute_us, std::memory_order_relaxed);
+    s_createLatencyUs.store(create_us, std::memory_order_relaxed);
+}
+
+void MockCfResetCounters() {
+    s_executeCalls.store(0, std::memory_order_relaxed);
+    s_bytesTransferred.store(0, std::memory_order_relaxed);
+    s_placeholdersCreated.store(0, std::memory_order_relaxed);
+}
+
+long long MockCfExecuteCalls() {
+    return s_executeCalls.load(std::memory_order_relaxed);
+}
+
+long long MockCfBytesTransferred() {
+    return s_bytesTransferred.load(std::memory_order_relaxed);
+}
+
+long long MockCfPlaceholdersCreated() {
+    return s_placeholdersCreated.load(std::memory_order_relaxed);
+}
+
+bool MockCfFireFetchData(CF_CONNECTION_KEY connKey, long long transferKey,
+                         const void *identity, int identityLen,
+                         long long offset, long long length,
+                         long long fileSize)
+{
+    MockConnection conn;
+    {
+        std::lock_guard<std::mutex> lock(s_connMutex);
+        auto it = s_conns.find(static_cast<long long>(connKey));
+        if (it == s_conns.end()) return false;
+        conn = it->second;
+    }
+    const CF_CALLBACK_REGISTRATION *reg =
+        FindCallback(conn, CF_CALLBACK_TYPE_FETCH_DATA);
+    if (!reg || !reg->Callback) return false;
+
+    CF_CALLBACK_INFO info = {};
+    info.StructSize = sizeof(info);
+    info.ConnectionKey = connKey;
+    info.CallbackContext = const_cast<LPVOID>(conn.context);
+    info.FileSize.QuadPart = fileSize;
+    info.FileIdentity = identity;
+    info.FileIdentityLength = static_cast<DWORD>(identityLen);
+    info.NormalizedPath = L"\\bench-root\\file.bin";
+    info.TransferKey.QuadPart = transferKey;
+
+    CF_CALLBACK_PARAMETERS params = {};
+    params.ParamSize = sizeof(params);
+    params.FetchData.RequiredFileOffset.QuadPart = offset;
+    params.FetchData.RequiredLength.QuadPart = length;
+
+    reg->Callback(&info, &params);
+    return true;
+}
+
+bool MockCfFireFetchPlaceholders(CF_CONNECTION_KEY connKey,
+                                 long long transferKey,
+                                 const void *identity, int identityLen,
+                                 const wchar_t *normalizedPath)
+{
+    MockConnection conn;
+    {
+        std::lock_guard<std::mutex> lock(s_connMutex);
+        auto it = s_conns.find(static_cast<long long>(connKey));
+        if (it == s_conns.end()) return false;
+        conn = it->second;
+    }
+    const CF_CALLBACK_REGISTRATION *reg =
+        FindCallback(conn, CF_CALLBACK_TYPE_FETCH_PLACEHOLDERS);
+    if (!reg || !reg->Callback) return false;
+
+    CF_CALLBACK_INFO info = {};
+    info.StructSize = sizeof(info);
+    info.ConnectionKey = connKey;
+    info.CallbackContext = const_cast<LPVOID>(conn.context);
+    info.FileIdentity = identity;
+    info.FileIdentityLength = static_cast<DWORD>(identityLen);
+    info.NormalizedPath = normalizedPath;
+    info.TransferKey.QuadPart = transferKey;
+
+    CF_CALLBACK_PARAMETERS params = {};
+    params.ParamSize = sizeof(params);
+
+    reg->Callback(&info, &params);
+    return true;
+}
+
+/* ---------- Mocked CfAPI entry points ---------- */
+
+extern "C" {
+
+HRESULT CfRegisterSyncRoot(LPCWSTR path, const CF_SYNC_REGISTRATION *reg,
+                           const CF_SYNC_POLICIES *policies,
+                           CF_REGISTER_FLAGS flags)
+{
+    (void)path; (void)reg; (void)policies; (void)flags;
+    return S_OK;
+}
+
+HRESULT CfUnregisterSyncRoot(LPCWSTR path) {
+    (void)path;
+    return S_OK;
+}
+
+HRESULT CfConnectSyncRoot(LPCWSTR path,
+                          const CF_CALLBACK_REGISTRATION *callbackTable,
+                          LPCVOID callbackContext, CF_CONNECT_FLAGS flags,
+                          CF_CONNECTION_KEY *key)
+{
+    (void)path; (void)flags;
+    std::lock_guard<std::mutex> lock(s_connMutex);
+    long long k = s_nextConnKey++;
+    s_conns[k] = MockConnection{callbackTable, callbackContext};
+    *key = static_cast<CF_CONNECTION_KEY>(k);
+    return S_OK;
+}
+
+HRESULT CfDisconnectSyncRoot(CF_CONNECTION_KEY key) {
+    std::lock_guard<std::mutex> lock(s_connMutex);
+    s_conns.erase(static_cast<long long>(key));
+    return S_OK;
+}
+
+HRESULT CfCreatePlaceholders(LPCWSTR baseDirectory,
+                             CF_PLACEHOLDER_CREATE_INFO *placeholders,
+                             DWORD count, CF_CREATE_FLAGS flags,
+                             DWORD *entriesProcessed)
+{
+    (void)baseDirectory; (void)flags;
+    BurnUs(s_createLatencyUs.load(std::memory_order_relaxed));
+    for (DWORD i = 0; i < count; i++) {
+        placeholders[i].Result = S_OK;
+    }
+    s_placeholdersCreated.fetch_add(count, std::memory_order_relaxed);
+    if (entriesProcessed) *entriesProcessed = count;
+    return S_OK;
+}
+
+HRESULT CfUpdatePlaceholder(HANDLE h, const CF_FS_METADATA *md,
+                            LPCVOID identity, DWORD identityLength,
+                            const CF_FILE_RANGE *dehydrateRanges,
+                            DWORD rangeCount, CF_UPDATE_FLAGS flags,
+                            LONGLONG *usn, OVERLAPPED *ov)
+{
+    (void)h; (void)md; (void)identity; (void)identityLength;
+    (void)dehydrateRanges; (void)rangeCount; (void)flags; (void)ov;
+    if (usn) *usn = 0;
+    return S_OK;
+}
+
+HRESULT CfExecute(const CF_OPERATION_INFO *opInfo,
+                  CF_OPERATION_PARAMETERS *opParams)
+{
+    BurnUs(s_executeLatencyUs.load(std::memory_order_relaxed));
+    s_executeCalls.fetch_add(1, std::memory_order_relaxed);
+    if (opInfo->Type == CF_OPERATION_TYPE_TRANSFER_DATA) {
+        s_bytesTransferred.fetch_add(opParams->TransferData.Length.QuadPart,
+                                     std::memory_order_relaxed);
+    }
+    return S_OK;
+}
+
+HRESULT CfHydratePlaceholder(HANDLE h, LARGE_INTEGER offset,
+                             LARGE_INTEGER length, CF_HYDRATE_FLAGS flags,
+                             OVERLAPPED *ov)
+{
+    (void)h; (void)offset; (void)length; (void)flags; (void)ov;
+    return S_OK;
+}
+
+HRESULT CfDehydratePlaceholder(HANDLE h, LARGE_INTEGER offset,
+                               LARGE_INTEGER length, CF_DEHYDRATE_FLAGS flags,
+                               OVERLAPPED *ov)
+{
+    (void)h; (void)offset; (void)length; (void)flags; (void)ov;
+    return S_OK;
+}
+
+HRESULT CfSetInSyncState(HANDLE h, CF_IN_SYNC_STATE state,
+                         CF_SET_IN_SYNC_FLAGS flags, LONGLONG *usn)
+{
+    (void)h; (void)state; (void)flags;
+    if (usn) *usn = 0;
+    return S_OK;
+}
+
+HRESULT CfGetPlaceholderInfo(HANDLE h, CF_PLACEHOLDER_INFO_CLASS infoClass,
+                             PVOID infoBuffer, DWORD bufferLength,
+                             DWORD *returnedLength)
+{
+    (void)h; (void)infoClass;
+    if (infoBuffer && bufferLength > 0) {
+        memset(infoBuffer, 0, bufferLength);
+    }
+    if (returnedLength) *returnedLength = bufferLength;
+    return S_OK;
+}
+
+HRESULT CfGetPlaceholderStateFromFindData(const WIN32_FIND_DATAW *findData,
+                                          CF_PLACEHOLDER_STATE *state)
+{
+    (void)findData;
+    if (state) *state = CF_PLACEHOLDER_STATE_PLACEHOLDER;
+    return S_OK;
+}
+
+} /* extern "C" */
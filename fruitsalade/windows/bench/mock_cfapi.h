@@ -0,0 +1,53 @@
+/*
+ * mock_cfapi.h - test double for the Windows Cloud Files API
+ *
+ * The benchmark build links cfapi_shim.cpp against these mocks instead of
+ * cldapi.lib, so the shim's own overhead (dispatch, coalescing, conversion,
+ * bookkeeping) can be measured without a cloud filter driver, a sync root
+ * or a server. The mocks count work and optionally burn a configurable
+ * per-call latency to model kernel cost on real volumes.
+ *
+ * Benchmark-only code: never linked into the client.
+ */
+
+#ifndef MOCK_CFAPI_H
+#define MOCK_CFAPI_H
+
+#include <windows.h>
+#include <cfapi.h>
+
+/*
+ * Latency injected into each mocked kernel call (CfExecute and
+ * CfCreatePlaceholders respectively). Busy-waits on the performance
+ * counter, so sub-millisecond values are honoured. Defaults to 0.
+ */
+void MockCfSetLatencyUs(int execute_us, int create_us);
+
+/* Cumulative counters since the last reset. */
+void MockCfResetCounters();
+long long MockCfExecuteCalls();
+long long MockCfBytesTransferred();
+long long MockCfPlaceholdersCreated();
+
+/*
+ * Re-fire the FETCH_DATA callback registered by CfConnectSyncRoot, the way
+ * the cloud filter driver would when an application reads a placeholder.
+ * Returns false when no connection with the key exists.
+ */
+bool MockCfFireFetchData(CF_CONNECTION_KEY connKey, long long transferKey,
+                         const void *identity, int identityLen,
+                         long long offset, long long length,
+                         long long fileSize);
+
+/*
+ * Re-fire the FETCH_PLACEHOLDERS callback, the way the driver would when an
+ * application enumerates an unpopulated directory. normalizedPath stands in
+ * for the directory being enumerated (it keys the shim's prefetch cooldown).
+ * Returns false when no connection with the key exists.
+ */
+bool MockCfFireFetchPlaceholders(CF_CONNECTION_KEY connKey,
+                                 long long transferKey,
+                                 const void *identity, int identityLen,
+                                 const wchar_t *normalizedPath);
+
+#endif /* MOCK_CFAPI_H */
@@ -5,7 +5,7 @@
  * It wraps the Windows CfAPI (Cloud Files API) to provide:
  *   - Sync root registration and connection
  *   - Placeholder creation and updates
- *   - Hydration callback dispatch to Go via goHydrationCallback
+ *   - Hydration callback dispatch to Go via goHydrationCallbackForRoot
  *   - Data transfer for hydration requests
  *
  * Build requirements:
@@ -19,18 +19,44 @@
 #ifdef _WIN32
 
 #include <windows.h>
+#include <bcrypt.h>
 #include <cfapi.h>
 #include <objbase.h>
 #include <pathcch.h>
 #include <shlobj.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
 #include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
 #include <vector>
+#include <cstdio>
+#include <cstdlib>
 #include <cstring>
+#include <ctime>
 
 #include "cfapi_shim.h"
 
+// Optional compressed-hydration support. The repo vendors no third-party
+// code, so zstd is opt-in: build with -DFRUITSALADE_WITH_ZSTD and link
+// libzstd, otherwise cfapi_transfer_chunk_compressed reports E_NOTIMPL.
+#ifdef FRUITSALADE_WITH_ZSTD
+#include <zstd.h>
+#pragma comment(lib, "libzstd.lib")
+#endif
+
 #pragma comment(lib, "cldapi.lib")
 #pragma comment(lib, "ole32.lib")
+#pragma comment(lib, "bcrypt.lib")
 
 /* ---------- Helpers ---------- */
 
@@ -44,6 +70,135 @@ static std::wstring Utf8ToWide(const char *utf8) {
     return result;
 }
 
+// Monotonic microseconds from QueryPerformanceCounter.
+static long long NowMicros() {
+    static long long s_freq = [] {
+        LARGE_INTEGER f;
+        QueryPerformanceFrequency(&f);
+        return f.QuadPart > 0 ? f.QuadPart : 1;
+    }();
+    LARGE_INTEGER now;
+    QueryPerformanceCounter(&now);
+    return now.QuadPart / s_freq * 1000000 +
+           now.QuadPart % s_freq * 1000000 / s_freq;
+}
+
+/* ---------- Path Interning ---------- */
+
+// Entry points are dominated by repeated UTF-8 -> wide conversions of the
+// same parent-path prefixes during placeholder bursts.  The interner caches
+// conversions in an arena of stable wstrings keyed by the UTF-8 bytes, so a
+// repeated path costs one hash lookup instead of two MultiByteToWideChar
+// passes and a heap allocation.  The Go side invalidates the cache on tree
+// refresh (cfapi_intern_invalidate); a size cap bounds memory in between.
+
+namespace {
+
+class WideInterner {
+public:
+    static WideInterner &Instance() {
+        static WideInterner s_instance;
+        return s_instance;
+    }
+
+    // Returns a stable wide pointer for the given UTF-8 string.  The pointer
+    // stays valid across invalidation and cache resets for a generous grace
+    // period (kRetireGraceUs), long enough to outlive any single shim call:
+    // callers hold interned pointers across kernel calls on other threads
+    // (dehydrate workers, batch creators), and Go invalidates from its
+    // refresh loop with no synchronization against those calls.
+    const wchar_t *Intern(const char *utf8) {
+        if (!utf8 || !*utf8) return L"";
+
+        std::string key(utf8);
+        {
+            std::shared_lock<std::shared_mutex> lock(m_mutex);
+            auto it = m_cache.find(key);
+            if (it != m_cache.end()) return it->second;
+        }
+
+        std::wstring wide = Utf8ToWide(utf8);
+
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        if (m_cache.size() >= kMaxEntries) {
+            RetireLocked();
+        }
+        auto it = m_cache.find(key);
+        if (it != m_cache.end()) return it->second;
+        m_arena.push_back(std::move(wide));
+        const wchar_t *stable = m_arena.back().c_str();
+        m_cache.emplace(std::move(key), stable);
+        return stable;
+    }
+
+    void Invalidate() {
+        std::unique_lock<std::shared_mutex> lock(m_mutex);
+        RetireLocked();
+    }
+
+private:
+    static const size_t kMaxEntries = 256 * 1024;
+    static const long long kRetireGraceUs = 60LL * 1000 * 1000;
+
+    // Never free the arena while other threads may still hold pointers into
+    // it.  Retired arenas are parked with a timestamp and only destroyed by
+    // a later reset once the grace period has passed; memory stays bounded
+    // because resets are rare (tree refreshes and the size cap).
+    void RetireLocked() {
+        long long now = NowMicros();
+        m_cache.clear();
+        if (!m_arena.empty()) {
+            m_retired.push_back({now, std::move(m_arena)});
+            m_arena.clear();
+        }
+        while (!m_retired.empty() &&
+               now - m_retired.front().retiredUs > kRetireGraceUs) {
+            m_retired.pop_front();
+        }
+    }
+
+    struct RetiredArena {
+        long long retiredUs;
+        std::deque<std::wstring> strings;
+    };
+
+    std::shared_mutex m_mutex;
+    std::unordered_map<std::string, const wchar_t *> m_cache;
+    std::deque<std::wstring> m_arena;  // deque: stable element addresses
+    std::deque<RetiredArena> m_retired;
+};
+
+// Interned conversion for paths that repeat across calls (parent directories,
+// placeholder paths).  One-off strings (names, identities) should keep using
+// Utf8ToWide directly.
+static const wchar_t *InternWide(const char *utf8) {
+    return WideInterner::Instance().Intern(utf8);
+}
+
+} /* namespace */
+
+// Convert wide string to UTF-8.
+static std::string WideToUtf8(const wchar_t *wide, int wideLen) {
+    if (!wide || wideLen == 0) return "";
+    int len = WideCharToMultiByte(CP_UTF8, 0, wide, wideLen, nullptr, 0,
+                                  nullptr, nullptr);
+    if (len <= 0) return "";
+    std::string result(len, '\0');
+    WideCharToMultiByte(CP_UTF8, 0, wide, wideLen, &result[0], len,
+                        nullptr, nullptr);
+    return result;
+}
+
+// Convert FILETIME to Unix timestamp (seconds).
+static long long FileTimeToUnix(const FILETIME &ft) {
+    ULARGE_INTEGER uli;
+    uli.LowPart = ft.dwLowDateTime;
+    uli.HighPart = ft.dwHighDateTime;
+    if (uli.QuadPart < 116444736000000000ULL) return 0;
+    return static_cast<long long>(
+        (uli.QuadPart - 116444736000000000ULL) / 10000000ULL);
+}
+
 // Convert Unix timestamp to FILETIME.
 static FILETIME UnixToFileTime(long long unixTime) {
     // Windows FILETIME epoch: Jan 1, 1601.  Unix epoch: Jan 1, 1970.
@@ -56,154 +211,4323 @@ static FILETIME UnixToFileTime(long long unixTime) {
     return ft;
 }
 
-/* ---------- Hydration Callback ---------- */
+/* ---------- Population Policy ---------- */
+
+// 0 = full population (eager placeholder walk), 1 = on-demand: the sync root
+// registers with CF_POPULATION_POLICY_PARTIAL and directories are filled in
+// the FETCH_PLACEHOLDERS callback when Explorer first enumerates them.
+static std::atomic<int> s_onDemandPopulation{0};
+
+// Fill one CF_PLACEHOLDER_CREATE_INFO from raw fields.  The identity blob is
+// not required to be NUL-terminated; wName must outlive the CfAPI call that
+// consumes the struct.
+static void FillCreateInfoRaw(CF_PLACEHOLDER_CREATE_INFO &info,
+                              const char *identity, int identityLen,
+                              long long fileSize, long long mtimeUnix,
+                              int isDirectory, const wchar_t *wName)
+{
+    FILETIME ftMtime = UnixToFileTime(mtimeUnix);
+    LONGLONG mtime = *reinterpret_cast<LONGLONG *>(&ftMtime);
+
+    info = {};
+    info.FileIdentity = identity;
+    info.FileIdentityLength = static_cast<DWORD>(identityLen);
+    info.RelativeFileName = wName;
+    info.FsMetadata.FileSize.QuadPart = fileSize;
+    info.FsMetadata.BasicInfo.CreationTime.QuadPart = mtime;
+    info.FsMetadata.BasicInfo.LastWriteTime.QuadPart = mtime;
+    info.FsMetadata.BasicInfo.ChangeTime.QuadPart = mtime;
+    info.FsMetadata.BasicInfo.LastAccessTime.QuadPart = mtime;
+
+    if (isDirectory) {
+        info.FsMetadata.BasicInfo.FileAttributes = FILE_ATTRIBUTE_DIRECTORY;
+        info.Flags = CF_PLACEHOLDER_CREATE_FLAG_MARK_IN_SYNC;
+        if (!s_onDemandPopulation.load(std::memory_order_relaxed)) {
+            // Eager mode: we populate children ourselves, so tell CfAPI the
+            // directory never needs on-demand population.
+            info.Flags = info.Flags |
+                         CF_PLACEHOLDER_CREATE_FLAG_DISABLE_ON_DEMAND_POPULATION;
+        }
+    } else {
+        info.FsMetadata.BasicInfo.FileAttributes = FILE_ATTRIBUTE_NORMAL;
+        info.Flags = CF_PLACEHOLDER_CREATE_FLAG_MARK_IN_SYNC;
+    }
+
+    info.Result = S_OK;
+}
+
+// Fill one CF_PLACEHOLDER_CREATE_INFO from an entry descriptor.
+static void FillCreateInfo(CF_PLACEHOLDER_CREATE_INFO &info,
+                           const cfapi_placeholder_entry &entry,
+                           const wchar_t *wName)
+{
+    FillCreateInfoRaw(info, entry.file_identity,
+                      static_cast<int>(strlen(entry.file_identity)),
+                      entry.file_size, entry.mtime_unix, entry.is_directory,
+                      wName);
+}
+
+/* ---------- Placeholder Index ---------- */
+
+// Persistent identity -> {relative path, size, version, state} map.  The
+// index is a memory-mapped open-addressing hash table with linear probing,
+// stored next to the sync root ("<root>.fsidx"), so resolving a hydration
+// callback's identity is one hash probe against warm pages instead of a
+// recursive Go tree walk — and the mapping survives process restarts, so
+// there is no cold-start rebuild either.  It is updated inline by the
+// placeholder create/update/dehydrate entry points and queried from C++ and
+// (via cfapi_lookup_identity) from Go.
+
+namespace {
+
+const unsigned int kIndexMagic = 0x58495346;  // 'FSIX'
+// v2: identity capacity widened for hashed "FSI2|<id>|<sha256-hex>" blobs,
+// which run 70+ bytes; v1 indexes (55-byte cap) are rebuilt on open.
+const unsigned int kIndexFormatVersion = 2;
+const unsigned int kIndexInitialBuckets = 1 << 16;  // power of two
+// Holds a v2 identity with a file ID up to 73 bytes and keeps IndexSlot at
+// 176 bytes. Oversized identities are counted in cfapi_get_stats
+// ("index_oversized_identities") instead of being dropped silently.
+const int kIndexMaxIdentity = 143;
+
+// Identities too long for an IndexSlot; nonzero means files are missing
+// from the index and hydrating by tree walk instead.
+static std::atomic<unsigned long long> s_statIndexOversized{0};
+
+struct IndexHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int bucketCount;
+    unsigned int used;
+    unsigned int arenaCap;
+    unsigned int arenaUsed;
+    unsigned int reserved[2];
+};
+
+struct IndexSlot {
+    unsigned long long hash;     // 0 = empty
+    long long size;
+    int pathOffset;              // into the path arena
+    int pathLen;
+    int fileVersion;
+    unsigned int state;          // CFAPI_INDEX_STATE_* bits
+    unsigned char identityLen;
+    char identity[kIndexMaxIdentity];
+};
+
+static unsigned long long Fnv64(const char *data, int len) {
+    unsigned long long h = 14695981039346656037ULL;
+    for (int i = 0; i < len; i++) {
+        h ^= static_cast<unsigned char>(data[i]);
+        h *= 1099511628211ULL;
+    }
+    return h ? h : 1;  // 0 marks an empty slot
+}
+
+class PlaceholderIndex {
+public:
+    explicit PlaceholderIndex(const std::wstring &root) : m_root(root) {}
+    ~PlaceholderIndex() { CloseMapping(); }
+
+    const std::wstring &Root() const { return m_root; }
+
+    bool Open() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return OpenMapping(IndexPath(), kIndexInitialBuckets);
+    }
+
+    // Insert or update a record.  relPath may be null to keep the stored
+    // path; size < 0 keeps the stored size; state is always applied.
+    void Put(const char *identity, int identityLen,
+             const char *relPath, int relPathLen,
+             long long size, int fileVersion, unsigned int state)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header || identityLen <= 0) return;
+        if (identityLen > kIndexMaxIdentity) {
+            s_statIndexOversized.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        if (m_header->used * 10 >= m_header->bucketCount * 7 ||
+            (relPath &&
+             m_header->arenaUsed + relPathLen > m_header->arenaCap)) {
+            if (!Grow()) return;
+        }
+
+        IndexSlot *slot = Probe(identity, identityLen, true);
+        if (!slot) return;
+
+        if (slot->hash == 0) {
+            slot->hash = Fnv64(identity, identityLen);
+            slot->identityLen = static_cast<unsigned char>(identityLen);
+            memcpy(slot->identity, identity, identityLen);
+            slot->pathOffset = -1;
+            slot->pathLen = 0;
+            m_header->used++;
+        }
+
+        if (relPath && relPathLen > 0) {
+            // Paths are immutable once appended; a changed path gets a new
+            // arena range and the old bytes are reclaimed on the next grow.
+            if (slot->pathLen != relPathLen ||
+                memcmp(Arena() + slot->pathOffset, relPath, relPathLen) != 0) {
+                slot->pathOffset = static_cast<int>(m_header->arenaUsed);
+                slot->pathLen = relPathLen;
+                memcpy(Arena() + slot->pathOffset, relPath, relPathLen);
+                m_header->arenaUsed += relPathLen;
+            }
+        }
+        if (size >= 0) slot->size = size;
+        if (fileVersion >= 0) slot->fileVersion = fileVersion;
+        slot->state = state;
+    }
+
+    // Merge state bits into an existing record; no-op when absent.
+    void SetState(const char *identity, int identityLen, unsigned int state) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header || identityLen <= 0) return;
+        if (identityLen > kIndexMaxIdentity) {
+            s_statIndexOversized.fetch_add(1, std::memory_order_relaxed);
+            return;
+        }
+        IndexSlot *slot = Probe(identity, identityLen, false);
+        if (slot && slot->hash != 0) slot->state = state;
+    }
+
+    bool Lookup(const char *identity, int identityLen,
+                std::string *outPath, long long *outSize,
+                int *outVersion, unsigned int *outState)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header || identityLen <= 0) return false;
+        if (identityLen > kIndexMaxIdentity) {
+            s_statIndexOversized.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        IndexSlot *slot = Probe(identity, identityLen, false);
+        if (!slot || slot->hash == 0) return false;
+
+        if (outPath && slot->pathOffset >= 0) {
+            outPath->assign(Arena() + slot->pathOffset, slot->pathLen);
+        }
+        if (outSize) *outSize = slot->size;
+        if (outVersion) *outVersion = slot->fileVersion;
+        if (outState) *outState = slot->state;
+        return true;
+    }
+
+private:
+    std::wstring IndexPath() const { return m_root + L".fsidx"; }
+
+    static long long FileSizeFor(unsigned int buckets) {
+        // Path arena sized at 64 bytes per bucket.
+        return static_cast<long long>(sizeof(IndexHeader)) +
+               static_cast<long long>(buckets) * sizeof(IndexSlot) +
+               static_cast<long long>(buckets) * 64;
+    }
+
+    char *Arena() {
+        return reinterpret_cast<char *>(m_header + 1) +
+               static_cast<long long>(m_header->bucketCount) * sizeof(IndexSlot);
+    }
+
+    IndexSlot *Slots() {
+        return reinterpret_cast<IndexSlot *>(m_header + 1);
+    }
+
+    // Linear probing; returns the matching slot, the first free slot when
+    // inserting, or null when the table is full / unusable.
+    IndexSlot *Probe(const char *identity, int identityLen, bool forInsert) {
+        unsigned long long h = Fnv64(identity, identityLen);
+        unsigned int mask = m_header->bucketCount - 1;
+        IndexSlot *slots = Slots();
+        for (unsigned int i = 0; i <= mask; i++) {
+            IndexSlot *slot = &slots[(h + i) & mask];
+            if (slot->hash == 0) {
+                return forInsert ? slot : nullptr;
+            }
+            if (slot->hash == h &&
+                slot->identityLen == identityLen &&
+                memcmp(slot->identity, identity, identityLen) == 0) {
+                return slot;
+            }
+        }
+        return nullptr;
+    }
+
+    bool OpenMapping(const std::wstring &path, unsigned int buckets) {
+        // FILE_SHARE_DELETE because Grow renames the sibling file over the
+        // live index while this handle and its view are still open.
+        HANDLE file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                                  FILE_SHARE_READ | FILE_SHARE_DELETE,
+                                  nullptr, OPEN_ALWAYS,
+                                  FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) return false;
+
+        LARGE_INTEGER existing = {};
+        bool fresh = !GetFileSizeEx(file, &existing) || existing.QuadPart == 0;
+        long long mapSize = fresh ? FileSizeFor(buckets) : existing.QuadPart;
+
+        HANDLE mapping = CreateFileMappingW(
+            file, nullptr, PAGE_READWRITE,
+            static_cast<DWORD>(mapSize >> 32),
+            static_cast<DWORD>(mapSize & 0xFFFFFFFF), nullptr);
+        if (!mapping) {
+            CloseHandle(file);
+            return false;
+        }
+        void *view = MapViewOfFile(mapping, FILE_MAP_ALL_ACCESS, 0, 0,
+                                   static_cast<SIZE_T>(mapSize));
+        if (!view) {
+            CloseHandle(mapping);
+            CloseHandle(file);
+            return false;
+        }
+
+        IndexHeader *header = static_cast<IndexHeader *>(view);
+        if (fresh) {
+            memset(header, 0, sizeof(*header));
+            header->magic = kIndexMagic;
+            header->version = kIndexFormatVersion;
+            header->bucketCount = buckets;
+            header->arenaCap = buckets * 64;
+        } else if (header->magic != kIndexMagic ||
+                   header->version != kIndexFormatVersion ||
+                   header->bucketCount == 0 ||
+                   (header->bucketCount & (header->bucketCount - 1)) != 0 ||
+                   FileSizeFor(header->bucketCount) > mapSize) {
+            // Corrupt or from an incompatible build: start over.
+            memset(header, 0, sizeof(*header));
+            header->magic = kIndexMagic;
+            header->version = kIndexFormatVersion;
+            header->bucketCount = buckets;
+            header->arenaCap = buckets * 64;
+            if (FileSizeFor(buckets) > mapSize) {
+                UnmapViewOfFile(view);
+                CloseHandle(mapping);
+                CloseHandle(file);
+                DeleteFileW(path.c_str());
+                return OpenMapping(path, buckets);
+            }
+            memset(header + 1, 0,
+                   static_cast<size_t>(FileSizeFor(buckets)) - sizeof(*header));
+        }
+
+        m_file = file;
+        m_mapping = mapping;
+        m_header = header;
+        return true;
+    }
+
+    void CloseMapping() {
+        if (m_header) {
+            FlushViewOfFile(m_header, 0);
+            UnmapViewOfFile(m_header);
+            m_header = nullptr;
+        }
+        if (m_mapping) { CloseHandle(m_mapping); m_mapping = nullptr; }
+        if (m_file != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_file);
+            m_file = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    // Rebuild into a double-sized sibling file (compacting the path arena),
+    // then atomically replace the live index.
+    bool Grow() {
+        IndexHeader *oldHeader = m_header;
+        HANDLE oldFile = m_file;
+        HANDLE oldMapping = m_mapping;
+
+        std::wstring newPath = IndexPath() + L".new";
+        m_header = nullptr;
+        m_file = INVALID_HANDLE_VALUE;
+        m_mapping = nullptr;
+        DeleteFileW(newPath.c_str());
+        if (!OpenMapping(newPath, oldHeader->bucketCount * 2)) {
+            m_header = oldHeader;
+            m_file = oldFile;
+            m_mapping = oldMapping;
+            return false;
+        }
+
+        const IndexSlot *oldSlots =
+            reinterpret_cast<const IndexSlot *>(oldHeader + 1);
+        const char *oldArena =
+            reinterpret_cast<const char *>(oldHeader + 1) +
+            static_cast<long long>(oldHeader->bucketCount) * sizeof(IndexSlot);
+        for (unsigned int i = 0; i < oldHeader->bucketCount; i++) {
+            const IndexSlot &s = oldSlots[i];
+            if (s.hash == 0) continue;
+            IndexSlot *slot = Probe(s.identity, s.identityLen, true);
+            if (!slot) continue;
+            *slot = s;
+            if (s.pathOffset >= 0) {
+                slot->pathOffset = static_cast<int>(m_header->arenaUsed);
+                memcpy(Arena() + slot->pathOffset, oldArena + s.pathOffset,
+                       s.pathLen);
+                m_header->arenaUsed += s.pathLen;
+            }
+            m_header->used++;
+        }
+
+        unsigned int oldBuckets = oldHeader->bucketCount;
+        UnmapViewOfFile(oldHeader);
+        CloseHandle(oldMapping);
+        CloseHandle(oldFile);
+        if (!MoveFileExW(newPath.c_str(), IndexPath().c_str(),
+                         MOVEFILE_REPLACE_EXISTING)) {
+            // The rename must land: serving from a forked ".new" file would
+            // split the live index from the one reopened after restart.
+            // Drop the sibling and fall back to the on-disk index.
+            CloseMapping();
+            DeleteFileW(newPath.c_str());
+            OpenMapping(IndexPath(), oldBuckets);
+            return false;
+        }
+        return true;
+    }
+
+    std::wstring m_root;  // absolute root, no trailing slash
+    std::mutex m_mutex;
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+    IndexHeader *m_header = nullptr;
+};
+
+static std::mutex s_indexMutex;
+static std::vector<PlaceholderIndex *> s_indexes;
+
+static PlaceholderIndex *IndexForRoot(const std::wstring &root) {
+    std::lock_guard<std::mutex> lock(s_indexMutex);
+    for (PlaceholderIndex *idx : s_indexes) {
+        if (_wcsicmp(idx->Root().c_str(), root.c_str()) == 0) return idx;
+    }
+    return nullptr;
+}
+
+// Resolve the index owning an absolute path and return the root-relative
+// remainder, '/'-separated as stored in the arena.
+static PlaceholderIndex *IndexForAbsPath(const std::wstring &absPath,
+                                         std::string *relOut)
+{
+    std::lock_guard<std::mutex> lock(s_indexMutex);
+    for (PlaceholderIndex *idx : s_indexes) {
+        const std::wstring &root = idx->Root();
+        if (absPath.size() > root.size() + 1 &&
+            _wcsnicmp(absPath.c_str(), root.c_str(), root.size()) == 0 &&
+            absPath[root.size()] == L'\\') {
+            std::wstring rel = absPath.substr(root.size() + 1);
+            for (wchar_t &c : rel) {
+                if (c == L'\\') c = L'/';
+            }
+            *relOut = WideToUtf8(rel.c_str(), static_cast<int>(rel.size()));
+            return idx;
+        }
+    }
+    return nullptr;
+}
+
+// Index one placeholder by absolute path (no-op when no index covers it).
+static void IndexPutAbs(const std::wstring &absPath,
+                        const char *identity, int identityLen,
+                        long long size, unsigned int state)
+{
+    std::string rel;
+    PlaceholderIndex *idx = IndexForAbsPath(absPath, &rel);
+    if (idx) {
+        idx->Put(identity, identityLen, rel.c_str(),
+                 static_cast<int>(rel.size()), size, -1, state);
+    }
+}
+
+} /* namespace */
+
+/* ---------- Stage Latency Instrumentation ---------- */
+
+// "Opening files is slow" reports were undiagnosable because a hydration
+// crosses four opaque boundaries: callback delivery, dispatcher queueing, the
+// Go round trip and CfExecute.  Each stage now feeds a lock-free log2
+// histogram (and, when built with FRUITSALADE_WITH_ETW, paired begin/end ETW
+// events) so cfapi_get_stats can report counts and tail latencies per stage
+// without perturbing the hot path beyond a few relaxed atomics.
+
+#ifdef FRUITSALADE_WITH_ETW
+#include <TraceLoggingProvider.h>
+// {b1c94d5a-3e87-4f10-9d22-6a51c0fc8e47}
+TRACELOGGING_DEFINE_PROVIDER(
+    g_shimTraceProvider, "FruitSalade-CfShim",
+    (0xb1c94d5a, 0x3e87, 0x4f10, 0x9d, 0x22, 0x6a, 0x51, 0xc0, 0xfc, 0x8e, 0x47));
+#define SHIM_TRACE_BEGIN(stage, key)                                  \
+    TraceLoggingWrite(g_shimTraceProvider, "StageBegin",              \
+                      TraceLoggingString(stage, "Stage"),             \
+                      TraceLoggingInt64((key), "TransferKey"))
+#define SHIM_TRACE_END(stage, key, durationUs)                        \
+    TraceLoggingWrite(g_shimTraceProvider, "StageEnd",                \
+                      TraceLoggingString(stage, "Stage"),             \
+                      TraceLoggingInt64((key), "TransferKey"),        \
+                      TraceLoggingInt64((durationUs), "DurationUs"))
+#else
+#define SHIM_TRACE_BEGIN(stage, key) ((void)0)
+#define SHIM_TRACE_END(stage, key, durationUs) ((void)0)
+#endif
+
+namespace {
+
+// Log2-bucketed latency histogram (bucket i holds samples < 2^i µs).
+// Recording is a pair of relaxed atomic increments; snapshots tolerate being
+// slightly torn, which is fine for monitoring.
+struct StageHistogram {
+    static const int kBuckets = 40;  // 2^39 µs ≈ 6 days, plenty of headroom
+    std::atomic<unsigned long long> buckets[kBuckets];
+    std::atomic<unsigned long long> count{0};
+    std::atomic<unsigned long long> sumUs{0};
+
+    void Record(long long us) {
+        if (us < 0) us = 0;
+        int bucket = 0;
+        while (bucket < kBuckets - 1 && (1LL << bucket) <= us) bucket++;
+        buckets[bucket].fetch_add(1, std::memory_order_relaxed);
+        count.fetch_add(1, std::memory_order_relaxed);
+        sumUs.fetch_add(static_cast<unsigned long long>(us),
+                        std::memory_order_relaxed);
+    }
+
+    // Upper bound (µs) of the bucket containing the q-th quantile.
+    long long Quantile(double q) const {
+        unsigned long long total = count.load(std::memory_order_relaxed);
+        if (total == 0) return 0;
+        unsigned long long target =
+            static_cast<unsigned long long>(total * q);
+        if (target >= total) target = total - 1;
+        unsigned long long seen = 0;
+        for (int i = 0; i < kBuckets; i++) {
+            seen += buckets[i].load(std::memory_order_relaxed);
+            if (seen > target) return 1LL << i;
+        }
+        return 1LL << (kBuckets - 1);
+    }
+};
+
+enum StatStage {
+    kStageQueueWait = 0,   // Submit -> worker pickup
+    kStageGoDispatch = 1,  // goHydrationCallback round trip (fetch + stream)
+    kStageCfExecute = 2,   // CfExecute(TRANSFER_DATA) syscall
+    kStageCount = 3,
+};
+
+static const char *const kStageNames[kStageCount] = {
+    "queue_wait", "go_dispatch", "cf_execute",
+};
+
+static StageHistogram s_stageHist[kStageCount];
+static std::atomic<unsigned long long> s_statBytesTransferred{0};
+
+static void RecordStage(int stage, long long us) {
+    s_stageHist[stage].Record(us);
+}
+
+} /* namespace */
+
+/* ---------- Block Cache ---------- */
+
+// A placeholder dehydrated by the nightly eviction job and re-opened a week
+// later used to re-download every byte even when the file never changed.
+// The shim keeps its own content cache: fixed 1 MB blocks keyed by
+// (file identity, version, block index), stored in a ring-allocated data
+// file with a memory-mapped open-addressing index.  Hydration workers serve
+// the cached prefix of each request straight through CfExecute and dispatch
+// only the remainder to Go; transfer sessions populate the cache with the
+// aligned blocks they stream.  Version bumps change the key, so stale
+// content ages out of the ring without explicit invalidation.
+
+namespace {
+
+const long long kCacheBlockSize = 1024 * 1024;  // matches kTransferBufferSize
+const unsigned int kCacheMagic = 0x43425346;    // 'FSBC'
+const unsigned int kCacheFormatVersion = 1;
+
+struct BlockCacheHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int bucketCount;  // power of two
+    unsigned int reserved0;
+    long long maxBytes;        // data-file capacity; multiple of block size
+    long long writeCursor;     // monotonic; block lives at cursor % maxBytes
+    long long reserved[2];
+};
+
+struct BlockSlot {
+    unsigned long long hash;  // 0 = empty
+    long long seq;            // writeCursor value when the block was stored
+    unsigned int length;      // valid bytes (tail blocks may be short)
+    unsigned int reserved;
+};
+
+// Key hash over (identity bytes, version, block index); never 0 so empty
+// slots stay distinguishable.
+static unsigned long long BlockHash(const char *identity, int identityLen,
+                                    int version, long long blockIdx)
+{
+    unsigned long long h = Fnv64(identity, identityLen);
+    h ^= static_cast<unsigned long long>(version) * 0x100000001B3ULL;
+    h ^= static_cast<unsigned long long>(blockIdx) * 0xC6A4A7935BD1E995ULL;
+    h *= 0x100000001B3ULL;
+    return h ? h : 1;
+}
+
+class BlockCache {
+public:
+    static BlockCache &Instance() {
+        static BlockCache s_instance;
+        return s_instance;
+    }
+
+    bool Enabled() {
+        return m_enabled.load(std::memory_order_acquire);
+    }
+
+    // Open (or create) the cache at path, sized to maxBytes of block data.
+    // The index lives beside it in "<path>.idx"; a corrupt or mismatched
+    // index is discarded and rebuilt empty.
+    HRESULT Open(const std::wstring &path, long long maxBytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        CloseLocked();
+
+        maxBytes &= ~(kCacheBlockSize - 1);
+        if (maxBytes < 16 * kCacheBlockSize) return E_INVALIDARG;
+
+        m_dataFile = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                                 FILE_SHARE_READ, nullptr, OPEN_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (m_dataFile == INVALID_HANDLE_VALUE) {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        HRESULT hr = OpenIndex(path + L".idx", maxBytes);
+        if (FAILED(hr)) {
+            CloseLocked();
+            return hr;
+        }
+        m_enabled.store(true, std::memory_order_release);
+        return S_OK;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        CloseLocked();
+    }
+
+    // Copy one cached block into buf (kCacheBlockSize capacity); returns the
+    // valid byte count, or -1 on miss / eviction by the write ring.
+    int Read(const char *identity, int identityLen, int version,
+             long long blockIdx, unsigned char *buf)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header) return -1;
+
+        BlockSlot *slot =
+            Probe(BlockHash(identity, identityLen, version, blockIdx), false);
+        if (!slot || slot->hash == 0 || !Resident(slot->seq)) {
+            s_statCacheMisses.fetch_add(1, std::memory_order_relaxed);
+            return -1;
+        }
+
+        LARGE_INTEGER pos;
+        pos.QuadPart = slot->seq % m_header->maxBytes;
+        DWORD read = 0;
+        if (!SetFilePointerEx(m_dataFile, pos, nullptr, FILE_BEGIN) ||
+            !ReadFile(m_dataFile, buf, slot->length, &read, nullptr) ||
+            read != slot->length) {
+            return -1;
+        }
+        // Re-check residency: the block could have been overwritten between
+        // the probe and the read if another thread advanced the ring.
+        if (!Resident(slot->seq)) return -1;
+        s_statCacheHitBytes.fetch_add(slot->length, std::memory_order_relaxed);
+        return static_cast<int>(slot->length);
+    }
+
+    // Store every block-aligned piece of [offset, offset+length); unaligned
+    // head bytes are skipped (hydration offsets are block-aligned in
+    // practice once readahead widens the range).
+    void Store(const char *identity, int identityLen, int version,
+               const unsigned char *data, long long offset, long long length)
+    {
+        long long skip = (kCacheBlockSize - offset % kCacheBlockSize) %
+                         kCacheBlockSize;
+        if (skip >= length) return;
+        data += skip;
+        offset += skip;
+        length -= skip;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header) return;
+        while (length > 0) {
+            long long take =
+                length < kCacheBlockSize ? length : kCacheBlockSize;
+            StoreBlock(BlockHash(identity, identityLen, version,
+                                 offset / kCacheBlockSize),
+                       data, static_cast<unsigned int>(take));
+            data += take;
+            offset += take;
+            length -= take;
+        }
+    }
+
+private:
+    // A block survives until the ring's write cursor laps it.
+    bool Resident(long long seq) const {
+        return m_header->writeCursor - seq <= m_header->maxBytes;
+    }
+
+    void StoreBlock(unsigned long long hash, const unsigned char *data,
+                    unsigned int length)
+    {
+        LARGE_INTEGER pos;
+        pos.QuadPart = m_header->writeCursor % m_header->maxBytes;
+        DWORD written = 0;
+        if (!SetFilePointerEx(m_dataFile, pos, nullptr, FILE_BEGIN) ||
+            !WriteFile(m_dataFile, data, length, &written, nullptr) ||
+            written != length) {
+            return;
+        }
+
+        BlockSlot *slot = Probe(hash, true);
+        if (slot) {
+            slot->hash = hash;
+            slot->seq = m_header->writeCursor;
+            slot->length = length;
+        }
+        // Advance by a full block even for short tails so blocks never
+        // straddle the ring seam (maxBytes is a block multiple).
+        m_header->writeCursor += kCacheBlockSize;
+    }
+
+    // Linear probing, bounded: on insert, an evicted (non-resident) slot is
+    // recycled and a full neighbourhood falls back to the oldest entry.
+    BlockSlot *Probe(unsigned long long hash, bool forInsert) {
+        const unsigned int kMaxProbe = 16;
+        unsigned int mask = m_header->bucketCount - 1;
+        BlockSlot *slots = reinterpret_cast<BlockSlot *>(m_header + 1);
+        BlockSlot *victim = nullptr;
+        for (unsigned int i = 0; i < kMaxProbe; i++) {
+            BlockSlot *slot = &slots[(hash + i) & mask];
+            if (slot->hash == hash) return slot;
+            if (slot->hash == 0) return forInsert ? slot : nullptr;
+            if (forInsert && (!victim || slot->seq < victim->seq)) {
+                victim = slot;
+            }
+        }
+        return forInsert ? victim : nullptr;
+    }
+
+    HRESULT OpenIndex(const std::wstring &path, long long maxBytes) {
+        // Four buckets per cacheable block keeps the table sparse enough
+        // for short probe chains.
+        unsigned int want =
+            static_cast<unsigned int>(maxBytes / kCacheBlockSize) * 4;
+        unsigned int buckets = 1;
+        while (buckets < want) buckets <<= 1;
+        long long fileSize = static_cast<long long>(sizeof(BlockCacheHeader)) +
+                             static_cast<long long>(buckets) * sizeof(BlockSlot);
+
+        for (int attempt = 0; attempt < 2; attempt++) {
+            m_indexFile = CreateFileW(path.c_str(),
+                                      GENERIC_READ | GENERIC_WRITE, 0, nullptr,
+                                      OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                                      nullptr);
+            if (m_indexFile == INVALID_HANDLE_VALUE) {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            LARGE_INTEGER existing = {};
+            GetFileSizeEx(m_indexFile, &existing);
+            bool fresh = existing.QuadPart == 0;
+
+            m_mapping = CreateFileMappingW(m_indexFile, nullptr,
+                                           PAGE_READWRITE,
+                                           static_cast<DWORD>(fileSize >> 32),
+                                           static_cast<DWORD>(fileSize),
+                                           nullptr);
+            if (!m_mapping) {
+                HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+                CloseHandle(m_indexFile);
+                m_indexFile = INVALID_HANDLE_VALUE;
+                return hr;
+            }
+            m_header = static_cast<BlockCacheHeader *>(MapViewOfFile(
+                m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0,
+                static_cast<SIZE_T>(fileSize)));
+            if (!m_header) {
+                HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+                CloseHandle(m_mapping);
+                m_mapping = nullptr;
+                CloseHandle(m_indexFile);
+                m_indexFile = INVALID_HANDLE_VALUE;
+                return hr;
+            }
+
+            if (fresh) {
+                memset(m_header, 0, sizeof(*m_header));
+                m_header->magic = kCacheMagic;
+                m_header->version = kCacheFormatVersion;
+                m_header->bucketCount = buckets;
+                m_header->maxBytes = maxBytes;
+                return S_OK;
+            }
+            if (m_header->magic == kCacheMagic &&
+                m_header->version == kCacheFormatVersion &&
+                m_header->bucketCount == buckets &&
+                m_header->maxBytes == maxBytes) {
+                return S_OK;
+            }
+
+            // Corrupt or resized: drop the index (content is re-fetched on
+            // miss, so this only costs warm-up) and rebuild it once.
+            UnmapViewOfFile(m_header);
+            m_header = nullptr;
+            CloseHandle(m_mapping);
+            m_mapping = nullptr;
+            CloseHandle(m_indexFile);
+            m_indexFile = INVALID_HANDLE_VALUE;
+            if (attempt == 0) DeleteFileW(path.c_str());
+        }
+        return E_FAIL;
+    }
+
+    void CloseLocked() {
+        m_enabled.store(false, std::memory_order_release);
+        if (m_header) {
+            FlushViewOfFile(m_header, 0);
+            UnmapViewOfFile(m_header);
+            m_header = nullptr;
+        }
+        if (m_mapping) {
+            CloseHandle(m_mapping);
+            m_mapping = nullptr;
+        }
+        if (m_indexFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_indexFile);
+            m_indexFile = INVALID_HANDLE_VALUE;
+        }
+        if (m_dataFile != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_dataFile);
+            m_dataFile = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    std::mutex m_mutex;
+    std::atomic<bool> m_enabled{false};
+    HANDLE m_dataFile = INVALID_HANDLE_VALUE;
+    HANDLE m_indexFile = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+    BlockCacheHeader *m_header = nullptr;
+
+public:
+    static std::atomic<unsigned long long> s_statCacheHitBytes;
+    static std::atomic<unsigned long long> s_statCacheMisses;
+};
+
+std::atomic<unsigned long long> BlockCache::s_statCacheHitBytes{0};
+std::atomic<unsigned long long> BlockCache::s_statCacheMisses{0};
+
+// Current version recorded for an identity in any open placeholder index
+// (0 when unknown); versions partition the block cache keyspace, so a
+// server-side update naturally orphans the old blocks.
+static int VersionForIdentity(const char *identity, int identityLen) {
+    std::lock_guard<std::mutex> lock(s_indexMutex);
+    for (PlaceholderIndex *idx : s_indexes) {
+        int version = 0;
+        if (idx->Lookup(identity, identityLen, nullptr, nullptr, &version,
+                        nullptr)) {
+            return version;
+        }
+    }
+    return 0;
+}
+
+} /* namespace */
+
+/* ---------- Adaptive Range Sizing ---------- */
+
+// The dispatch layer has no notion of link quality: the readahead window
+// and stripe size that keep a LAN busy turn a hotel Wi-Fi hydration into a
+// multi-minute stall with Explorer blocked on the first byte.  The governor
+// watches completed transfer sessions (bytes and wall time) and keeps an
+// AIMD budget for how large a range is worth handing to Go in one piece:
+// a session that outlives the latency target halves the budget, a session
+// that finishes inside it grows the budget additively.  The values set via
+// cfapi_set_readahead / cfapi_set_transfer_options act as ceilings; the
+// governor only ever shrinks below them.
+
+namespace {
+
+class BandwidthGovernor {
+public:
+    static BandwidthGovernor &Instance() {
+        static BandwidthGovernor s_instance;
+        return s_instance;
+    }
+
+    // Record a completed, successful transfer session.  Short sessions are
+    // ignored: they say more about request size than link quality.
+    void Observe(long long bytes, long long elapsedUs) {
+        if (bytes < kMinSampleBytes || elapsedUs <= 0) return;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (elapsedUs > kTargetRangeUs) {
+            m_budget /= 2;
+            if (m_budget < kBudgetMin) m_budget = kBudgetMin;
+        } else {
+            m_budget += kBudgetStep;
+            if (m_budget > kBudgetMax) m_budget = kBudgetMax;
+        }
+        double bps = bytes * 1e6 / elapsedUs;
+        m_estimatedBps = m_estimatedBps > 0
+                             ? 0.7 * m_estimatedBps + 0.3 * bps
+                             : bps;
+    }
+
+    // Current per-range budget in bytes, 4 KB aligned.
+    long long RangeBudget() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_budget & ~0xFFFLL;
+    }
+
+    // Smoothed link estimate, for cfapi_get_stats.
+    long long EstimatedBps() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return static_cast<long long>(m_estimatedBps);
+    }
+
+private:
+    static const long long kMinSampleBytes = 256 * 1024;
+    static const long long kTargetRangeUs = 2000000;  // 2 s per range
+    static const long long kBudgetMin = 1024 * 1024;
+    static const long long kBudgetMax = 64LL * 1024 * 1024;
+    static const long long kBudgetStep = 2 * 1024 * 1024;
+
+    std::mutex m_mutex;
+    long long m_budget = 8 * 1024 * 1024;  // neutral start, adapts quickly
+    double m_estimatedBps = 0;
+};
+
+} /* namespace */
+
+/* ---------- Transfer Sessions ---------- */
+
+// A transfer session lets the Go side stream a hydration response in small
+// chunks without materializing the whole range.  Chunks are coalesced into a
+// reusable 1 MB buffer and handed to CfExecute only when the buffer fills or
+// the stream breaks contiguity, so a 4 GB hydration costs a flat 1 MB of
+// buffer and ~4000 CfExecute calls instead of a 4 GB allocation.
+
+namespace {
+
+const size_t kTransferBufferSize = 1024 * 1024;  // 1 MB, CfExecute-aligned
+
+struct TransferSession {
+    CF_CONNECTION_KEY connKey = {};
+    CF_TRANSFER_KEY transferKey = {};
+    std::vector<unsigned char> buffer;
+    long long bufferStart = -1;  // file offset of buffer[0], -1 = empty
+    HRESULT firstError = S_OK;
+
+    // Goodput sample for the bandwidth governor.
+    long long startUs = NowMicros();
+    long long bytesSent = 0;
+
+    // File identity and version of the stream, for block cache population
+    // (empty identity = don't cache).
+    std::string identity;
+    int fileVersion = 0;
+
+    // Zero-copy mode: a page-aligned, shim-owned buffer the Go side reads
+    // the HTTP body into directly, so CfExecute consumes the same bytes the
+    // network wrote (no CGO copy, no Go-heap staging).
+    unsigned char *zeroCopyBuf = nullptr;
+    size_t zeroCopyCap = 0;
+
+    // Compressed mode (cfapi_transfer_chunk_compressed): streaming
+    // decompressor state, its output scratch buffer, and the uncompressed
+    // file offset the next decompressed byte lands at.
+    void *zstd = nullptr;
+    std::vector<unsigned char> zstdScratch;
+    long long plainOffset = -1;
+
+    ~TransferSession() {
+        if (zeroCopyBuf) {
+            VirtualFree(zeroCopyBuf, 0, MEM_RELEASE);
+        }
+#ifdef FRUITSALADE_WITH_ZSTD
+        if (zstd) {
+            ZSTD_freeDStream(static_cast<ZSTD_DStream *>(zstd));
+        }
+#endif
+    }
+};
+
+static HRESULT ExecuteTransfer(CF_CONNECTION_KEY connKey,
+                               CF_TRANSFER_KEY transferKey,
+                               const void *data,
+                               long long offset,
+                               long long length)
+{
+    CF_OPERATION_INFO opInfo = {};
+    opInfo.StructSize = sizeof(opInfo);
+    opInfo.Type = CF_OPERATION_TYPE_TRANSFER_DATA;
+    opInfo.ConnectionKey = connKey;
+    opInfo.TransferKey = transferKey;
+
+    CF_OPERATION_PARAMETERS opParams = {};
+    opParams.ParamSize = CF_SIZE_OF_OP_PARAM(TransferData);
+    opParams.TransferData.CompletionStatus = STATUS_SUCCESS;
+    opParams.TransferData.Buffer = data;
+    opParams.TransferData.Offset.QuadPart = offset;
+    opParams.TransferData.Length.QuadPart = length;
+
+    SHIM_TRACE_BEGIN("cf_execute", transferKey.QuadPart);
+    long long start = NowMicros();
+    HRESULT hr = CfExecute(&opInfo, &opParams);
+    long long elapsed = NowMicros() - start;
+    RecordStage(kStageCfExecute, elapsed);
+    SHIM_TRACE_END("cf_execute", transferKey.QuadPart, elapsed);
+    if (SUCCEEDED(hr)) {
+        s_statBytesTransferred.fetch_add(
+            static_cast<unsigned long long>(length),
+            std::memory_order_relaxed);
+    }
+    return hr;
+}
+
+// Feed successfully transferred bytes into the block cache so the next
+// hydration of the same (identity, version) range is served locally.
+static void CachePopulate(TransferSession *session, const unsigned char *data,
+                          long long offset, long long length)
+{
+    if (session->identity.empty() || !BlockCache::Instance().Enabled()) {
+        return;
+    }
+    BlockCache::Instance().Store(session->identity.data(),
+                                 static_cast<int>(session->identity.size()),
+                                 session->fileVersion, data, offset, length);
+}
+
+// Flush the session's coalescing buffer to CfExecute. Records the first
+// failure so cfapi_transfer_end can report it.
+static void FlushSession(TransferSession *session) {
+    if (session->bufferStart < 0 || session->buffer.empty()) {
+        session->bufferStart = -1;
+        return;
+    }
+    HRESULT hr = ExecuteTransfer(session->connKey, session->transferKey,
+                                 session->buffer.data(), session->bufferStart,
+                                 static_cast<long long>(session->buffer.size()));
+    if (FAILED(hr) && SUCCEEDED(session->firstError)) {
+        session->firstError = hr;
+    }
+    if (SUCCEEDED(hr)) {
+        session->bytesSent += static_cast<long long>(session->buffer.size());
+        CachePopulate(session, session->buffer.data(), session->bufferStart,
+                      static_cast<long long>(session->buffer.size()));
+    }
+    session->buffer.clear();
+    session->bufferStart = -1;
+}
+
+} /* namespace */
+
+/* ---------- Hydration Dispatcher ---------- */
+
+/* ---------- Connection Registry ---------- */
+
+// One process can now serve several sync roots (personal root plus team
+// shares).  Each connection carries a context identifying its root; the
+// callbacks route requests to Go with the root ID so the Go side can resolve
+// the right backend instead of a single process-wide global.
+
+namespace {
+
+class RootWatcher;
+
+struct ConnectionContext {
+    int rootId = 0;
+    // Root path without drive letter or trailing backslash, for turning
+    // CfAPI's volume-relative NormalizedPath into a root-relative path.
+    std::wstring rootNoDrive;
+    // Watches FILE_ATTRIBUTE_PINNED transitions under the root (owned).
+    RootWatcher *watcher = nullptr;
+};
+
+static std::mutex s_connMutex;
+static std::unordered_map<long long, ConnectionContext *> s_connections;
+
+static const ConnectionContext *ContextFromCallback(
+    const CF_CALLBACK_INFO *info)
+{
+    return static_cast<const ConnectionContext *>(info->CallbackContext);
+}
+
+static int RootIdFromCallback(const CF_CALLBACK_INFO *info) {
+    const ConnectionContext *ctx = ContextFromCallback(info);
+    return ctx ? ctx->rootId : 0;
+}
+
+} /* namespace */
+
+/* ---------- Process Priority Classification ---------- */
+
+// A bulk "pin this folder" hydration started from the tray app must not
+// starve an interactive double-click in Explorer.  Requests are classified
+// by the originating process image (available because we connect with
+// CF_CONNECT_FLAG_REQUIRE_PROCESS_INFO); unknown processes default to
+// interactive so user applications always get the fast lane.
+
+namespace {
+
+enum HydrationPriority {
+    kPriorityInteractive = 0,
+    kPriorityBulk = 1,
+};
+
+static std::shared_mutex s_priorityMapMutex;
+static std::unordered_map<std::string, int> s_priorityMap;
+
+static std::string AsciiLower(std::string s) {
+    for (char &c : s) {
+        if (c >= 'A' && c <= 'Z') c += 'a' - 'A';
+    }
+    return s;
+}
+
+// Lowercase basename of the originating process image ("" when CfAPI did
+// not attach process info).
+static std::string ProcessImageName(const CF_CALLBACK_INFO *info) {
+    if (!info->ProcessInfo || !info->ProcessInfo->ImagePath) {
+        return std::string();
+    }
+    const wchar_t *image = info->ProcessInfo->ImagePath;
+    const wchar_t *base = image;
+    for (const wchar_t *p = image; *p; p++) {
+        if (*p == L'\\' || *p == L'/') base = p + 1;
+    }
+    return AsciiLower(WideToUtf8(base, static_cast<int>(wcslen(base))));
+}
+
+static int ClassifyProcess(const CF_CALLBACK_INFO *info) {
+    std::string name = ProcessImageName(info);
+    if (name.empty()) return kPriorityInteractive;
+
+    std::shared_lock<std::shared_mutex> lock(s_priorityMapMutex);
+    auto it = s_priorityMap.find(name);
+    return it != s_priorityMap.end() ? it->second : kPriorityInteractive;
+}
+
+} /* namespace */
+
+/* ---------- Hydration Admission Control ---------- */
+
+// One misbehaving scanner (an indexer, a DLP agent) can open every
+// placeholder on disk and turn a single seat into a fleet-wide hydration
+// storm against the server's content path.  Requests are metered before any
+// range state is created: each originating process image draws from a token
+// bucket, and a global in-flight byte ceiling bounds the seat as a whole.
+// Over-budget requests are completed with STATUS_CLOUD_FILE_REQUEST_TIMEOUT,
+// which the kernel surfaces as a retryable timeout — the scanner backs off
+// and retries while interactive traffic keeps spending its own budget.
+// Everything is off by default; policy comes from cfapi_set_hydration_policy.
+
+namespace {
+
+class AdmissionController {
+public:
+    static AdmissionController &Instance() {
+        static AdmissionController s_instance;
+        return s_instance;
+    }
+
+    // bytes-per-second 0 disables per-image metering (an override of 0
+    // exempts that image); inflight 0 disables the global ceiling.
+    void SetPolicy(long long defaultBps, long long burstBytes,
+                   long long globalInflight,
+                   std::unordered_map<std::string, long long> imageBps) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_defaultBps = defaultBps > 0 ? defaultBps : 0;
+        if (burstBytes > 0) m_burstBytes = burstBytes;
+        m_globalInflight = globalInflight > 0 ? globalInflight : 0;
+        m_imageBps = std::move(imageBps);
+        m_buckets.clear();
+    }
+
+    // Decide whether `bytes` for `image` may start hydrating now.  Buckets
+    // may run into debt, so a request larger than the burst is admitted once
+    // and paid off by denying what follows; an image that keeps within its
+    // refill rate never sees a denial.
+    bool Admit(const std::string &image, long long connKey,
+               long long transferKey, long long bytes) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // The ceiling never blocks the only request in flight; a single
+        // range larger than the ceiling must still be able to run.
+        if (m_globalInflight > 0 && m_inflight > 0 &&
+            m_inflight + bytes > m_globalInflight) {
+            m_denied.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+
+        long long bps = m_defaultBps;
+        auto override_ = m_imageBps.find(image);
+        if (override_ != m_imageBps.end()) bps = override_->second;
+
+        if (bps > 0 && !image.empty()) {
+            long long now = NowMicros();
+            Bucket &bucket = m_buckets[image];
+            if (bucket.lastRefillUs == 0) {
+                bucket.tokens = static_cast<double>(m_burstBytes);
+            } else {
+                bucket.tokens += static_cast<double>(now - bucket.lastRefillUs) *
+                                 static_cast<double>(bps) / 1e6;
+                if (bucket.tokens > static_cast<double>(m_burstBytes)) {
+                    bucket.tokens = static_cast<double>(m_burstBytes);
+                }
+            }
+            bucket.lastRefillUs = now;
+
+            if (bucket.tokens <= 0) {
+                m_denied.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            bucket.tokens -= static_cast<double>(bytes);
+        }
+
+        m_inflight += bytes;
+        m_admitted[std::make_pair(connKey, transferKey)] += bytes;
+        return true;
+    }
+
+    // Return a key's admitted bytes to the global budget once its last
+    // transfer session completes (the range tracker calls this when it
+    // drops the key).
+    void Release(long long connKey, long long transferKey) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_admitted.find(std::make_pair(connKey, transferKey));
+        if (it == m_admitted.end()) return;
+        m_inflight -= it->second;
+        if (m_inflight < 0) m_inflight = 0;
+        m_admitted.erase(it);
+    }
+
+    long long InflightBytes() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_inflight;
+    }
+
+    long long Denied() const {
+        return m_denied.load(std::memory_order_relaxed);
+    }
+
+private:
+    struct Bucket {
+        double tokens = 0;
+        long long lastRefillUs = 0;
+    };
+
+    std::mutex m_mutex;
+    long long m_defaultBps = 0;
+    long long m_burstBytes = 64LL << 20;
+    long long m_globalInflight = 0;
+    long long m_inflight = 0;
+    std::unordered_map<std::string, long long> m_imageBps;
+    std::unordered_map<std::string, Bucket> m_buckets;
+    std::map<std::pair<long long, long long>, long long> m_admitted;
+    std::atomic<long long> m_denied{0};
+};
+
+} /* namespace */
+
+// CfAPI delivers FETCH_DATA callbacks on a small pool of filter threads; a
+// synchronous CGO dispatch there serializes hydrations behind the slowest Go
+// round trip.  The dispatcher decouples the two: FetchDataCallback enqueues a
+// request into a bounded MPMC ring and returns immediately, and a pool of
+// worker threads drains the ring and calls into Go.  Hydration concurrency is
+// then bounded by the worker count, not by CfAPI's callback thread budget.
+//
+// Two lanes feed the workers: interactive requests go through the lock-free
+// ring and are served first; bulk requests sit in a mutexed deque behind
+// them, with an aging escape hatch so a continuous interactive stream cannot
+// starve a pin job forever.
+
+namespace {
+
+struct HydrationRequest {
+    int rootId = 0;
+    std::string identity;
+    long long offset = 0;
+    long long length = 0;
+    long long enqueuedUs = 0;  // NowMicros() at Submit, for queue-wait stats
+    CF_TRANSFER_KEY transferKey = {};
+    CF_CONNECTION_KEY connKey = {};
+};
+
+// Serve the longest cached prefix of a request straight through CfExecute
+// and shrink the request to the remainder.  Returns true when the whole
+// range came from the cache and nothing is left to dispatch to Go.  Runs on
+// a hydration worker, so the disk reads never stall a CfAPI filter thread.
+static bool ServeCachedPrefix(HydrationRequest &req) {
+    if (!BlockCache::Instance().Enabled() || req.identity.empty()) {
+        return false;
+    }
+    int version = VersionForIdentity(req.identity.data(),
+                                     static_cast<int>(req.identity.size()));
+    std::unique_ptr<unsigned char[]> block(
+        new (std::nothrow) unsigned char[kCacheBlockSize]);
+    if (!block) return false;
+
+    while (req.length > 0) {
+        long long within = req.offset % kCacheBlockSize;
+        long long want = kCacheBlockSize - within;
+        if (want > req.length) want = req.length;
+
+        int have = BlockCache::Instance().Read(
+            req.identity.data(), static_cast<int>(req.identity.size()),
+            version, req.offset / kCacheBlockSize, block.get());
+        if (have < within + want) break;  // miss, evicted, or short block
+
+        if (FAILED(ExecuteTransfer(req.connKey, req.transferKey,
+                                   block.get() + within, req.offset, want))) {
+            break;
+        }
+        req.offset += want;
+        req.length -= want;
+    }
+    return req.length == 0;
+}
+
+/* ---------- Range Coalescing / Readahead ---------- */
+
+// Antivirus and Explorer hydrate files as storms of small sequential reads.
+// The tracker keeps, per transfer key, the range already dispatched to Go and
+// the tail of the previous request.  Requests fully inside the in-flight
+// range are dropped (the running transfer will satisfy them), and detected
+// sequential streams are widened to a readahead window so hundreds of 64 KB
+// round trips collapse into a few multi-megabyte ones.
+
+// Readahead window in bytes (0 disables widening).  Kept 4 KB aligned so
+// widened transfers preserve CfExecute's offset alignment rules.
+static std::atomic<long long> s_readaheadWindow{8 * 1024 * 1024};
+
+// Striping: one FETCH_DATA for a huge range (a 40 GB assembly opened whole)
+// used to become a single serial Go round trip.  Ranges at least
+// s_stripeThreshold long are instead split into s_stripeSize pieces (at most
+// s_maxStripes per request) that hydrate concurrently on separate workers,
+// each completing with its own TRANSFER_DATA as its bytes arrive.
+static std::atomic<long long> s_stripeSize{16LL * 1024 * 1024};
+static std::atomic<long long> s_stripeThreshold{64LL * 1024 * 1024};
+static std::atomic<int> s_maxStripes{8};
+
+class RangeTracker {
+public:
+    static RangeTracker &Instance() {
+        static RangeTracker s_instance;
+        return s_instance;
+    }
+
+    // Decide what, if anything, to dispatch for a FETCH_DATA request.
+    // Returns false when the request is already covered by in-flight work;
+    // otherwise outOffset/outLength describe the (possibly widened) range.
+    // Transfer keys are only unique per connection, so the tracking key
+    // includes the connection key.
+    bool Plan(long long connKey, long long transferKey,
+              long long offset, long long length,
+              long long fileSize, long long *outOffset, long long *outLength)
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        KeyState &st = m_keys[std::make_pair(connKey, transferKey)];
+
+        long long reqEnd = offset + length;
+
+        // Fully covered by the range already handed to Go.
+        if (st.inflightStart >= 0 && offset >= st.inflightStart &&
+            reqEnd <= st.inflightEnd) {
+            st.lastEnd = reqEnd;
+            return false;
+        }
+
+        if (offset == st.lastEnd) {
+            st.sequentialStreak++;
+        } else {
+            st.sequentialStreak = 0;
+        }
+        st.lastEnd = reqEnd;
+
+        long long dispatchStart = offset;
+        long long dispatchEnd = reqEnd;
+
+        long long window = s_readaheadWindow.load(std::memory_order_relaxed);
+        // The configured window is a ceiling; the governor shrinks it on
+        // slow links so a widened range cannot stall for minutes.
+        long long budget = BandwidthGovernor::Instance().RangeBudget();
+        if (window > budget) window = budget;
+        if (window > 0 && st.sequentialStreak >= 1 && fileSize > 0) {
+            dispatchEnd = offset + window;
+            if (dispatchEnd > fileSize) dispatchEnd = fileSize;
+            if (dispatchEnd < reqEnd) dispatchEnd = reqEnd;
+        }
+
+        // Trim the head that overlaps work already in flight.
+        if (st.inflightStart >= 0 && dispatchStart >= st.inflightStart &&
+            dispatchStart < st.inflightEnd) {
+            dispatchStart = st.inflightEnd;
+        }
+        if (dispatchStart >= dispatchEnd) return false;
+
+        // Track the union when contiguous; otherwise the stream seeked and
+        // the new range replaces the old one.
+        if (st.inflightStart >= 0 && dispatchStart <= st.inflightEnd &&
+            dispatchEnd >= st.inflightStart) {
+            if (dispatchStart < st.inflightStart) st.inflightStart = dispatchStart;
+            if (dispatchEnd > st.inflightEnd) st.inflightEnd = dispatchEnd;
+        } else {
+            st.inflightStart = dispatchStart;
+            st.inflightEnd = dispatchEnd;
+        }
+
+        *outOffset = dispatchStart;
+        *outLength = dispatchEnd - dispatchStart;
+        st.pending++;
+        return true;
+    }
+
+    // A planned range that is striped becomes several transfer sessions, each
+    // ending in its own Complete call; Retain accounts for the extras so the
+    // tracking state outlives all of them.
+    void Retain(long long connKey, long long transferKey, int extra) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_keys.find(std::make_pair(connKey, transferKey));
+        if (it != m_keys.end()) it->second.pending += extra;
+    }
+
+    // Mark every outstanding session for the key as cancelled.  Returns
+    // false when nothing is in flight (the transfer already completed), so
+    // the cancel callback can skip waking Go.
+    bool Cancel(long long connKey, long long transferKey) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_keys.find(std::make_pair(connKey, transferKey));
+        if (it == m_keys.end()) return false;
+        it->second.cancelled = true;
+        return true;
+    }
+
+    // Whether the key was cancelled while its sessions were in flight.
+    bool Cancelled(long long connKey, long long transferKey) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_keys.find(std::make_pair(connKey, transferKey));
+        return it != m_keys.end() && it->second.cancelled;
+    }
+
+    // Called when a transfer session completes; drops the key's tracking
+    // state once the last outstanding session for it is done.
+    void Complete(long long connKey, long long transferKey) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_keys.find(std::make_pair(connKey, transferKey));
+        if (it == m_keys.end()) return;
+        if (it->second.pending > 1) {
+            it->second.pending--;
+            return;
+        }
+        m_keys.erase(it);
+        AdmissionController::Instance().Release(connKey, transferKey);
+    }
+
+private:
+    struct KeyState {
+        long long inflightStart = -1;
+        long long inflightEnd = -1;
+        long long lastEnd = -1;
+        int sequentialStreak = 0;
+        int pending = 0;  // outstanding transfer sessions for this key
+        bool cancelled = false;  // kernel abandoned the request
+    };
+
+    std::mutex m_mutex;
+    std::map<std::pair<long long, long long>, KeyState> m_keys;
+};
+
+// Bounded MPMC ring (Vyukov-style, per-cell sequence numbers).  Lock-free on
+// the enqueue/dequeue fast path; a condition variable is only used to park
+// idle workers.
+class HydrationQueue {
+public:
+    explicit HydrationQueue(size_t capacityPow2)
+        : m_cells(new Cell[capacityPow2]), m_mask(capacityPow2 - 1)
+    {
+        for (size_t i = 0; i <= m_mask; i++) {
+            m_cells[i].sequence.store(i, std::memory_order_relaxed);
+        }
+        m_enqueuePos.store(0, std::memory_order_relaxed);
+        m_dequeuePos.store(0, std::memory_order_relaxed);
+    }
+
+    bool TryEnqueue(HydrationRequest &&req) {
+        Cell *cell;
+        size_t pos = m_enqueuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if (diff == 0) {
+                if (m_enqueuePos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;  // full
+            } else {
+                pos = m_enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+        cell->request = std::move(req);
+        cell->sequence.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool TryDequeue(HydrationRequest &req) {
+        Cell *cell;
+        size_t pos = m_dequeuePos.load(std::memory_order_relaxed);
+        for (;;) {
+            cell = &m_cells[pos & m_mask];
+            size_t seq = cell->sequence.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+            if (diff == 0) {
+                if (m_dequeuePos.compare_exchange_weak(
+                        pos, pos + 1, std::memory_order_relaxed)) {
+                    break;
+                }
+            } else if (diff < 0) {
+                return false;  // empty
+            } else {
+                pos = m_dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+        req = std::move(cell->request);
+        cell->sequence.store(pos + m_mask + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Approximate occupancy (racy by design; monitoring only).
+    size_t Depth() const {
+        size_t enq = m_enqueuePos.load(std::memory_order_relaxed);
+        size_t deq = m_dequeuePos.load(std::memory_order_relaxed);
+        return enq > deq ? enq - deq : 0;
+    }
+
+private:
+    struct Cell {
+        std::atomic<size_t> sequence;
+        HydrationRequest request;
+    };
+
+    std::unique_ptr<Cell[]> m_cells;
+    size_t m_mask;
+    std::atomic<size_t> m_enqueuePos;
+    std::atomic<size_t> m_dequeuePos;
+};
+
+class HydrationDispatcher {
+public:
+    static HydrationDispatcher &Instance() {
+        static HydrationDispatcher s_instance;
+        return s_instance;
+    }
+
+    // Must be called before the first callback arrives (i.e. before
+    // cfapi_connect_sync_root); ignored once workers are running.
+    void SetWorkerCount(int count) {
+        if (count > 0 && count <= kMaxWorkers) {
+            m_workerCount = count;
+        }
+    }
+
+    void Submit(HydrationRequest &&req, int priority) {
+        EnsureStarted();
+        req.enqueuedUs = NowMicros();
+        if (priority == kPriorityBulk) {
+            {
+                std::lock_guard<std::mutex> lock(m_bulkMutex);
+                m_bulk.emplace_back(GetTickCount64(), std::move(req));
+            }
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_wake.notify_one();
+            return;
+        }
+        if (m_queue.TryEnqueue(std::move(req))) {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_wake.notify_one();
+        } else {
+            // Queue full: degrade to synchronous dispatch on the callback
+            // thread rather than dropping the hydration.
+            Dispatch(req);
+        }
+    }
+
+    void Stop() {
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            if (!m_running) return;
+            m_running = false;
+            m_wake.notify_all();
+        }
+        for (auto &worker : m_workers) {
+            if (worker.joinable()) worker.join();
+        }
+        m_workers.clear();
+        m_started = false;
+    }
+
+    // Observed queue depths, for cfapi_get_stats.
+    void QueueDepths(long long *interactive, long long *bulk) {
+        *interactive = static_cast<long long>(m_queue.Depth());
+        std::lock_guard<std::mutex> lock(m_bulkMutex);
+        *bulk = static_cast<long long>(m_bulk.size());
+    }
+
+private:
+    static const int kMaxWorkers = 128;
+    static const size_t kQueueCapacity = 1024;  // power of two
+    static const ULONGLONG kBulkAgingMs = 3000;
+
+    HydrationDispatcher() : m_queue(kQueueCapacity) {}
+
+    void EnsureStarted() {
+        if (m_started.load(std::memory_order_acquire)) return;
+        std::lock_guard<std::mutex> lock(m_wakeMutex);
+        if (m_started.load(std::memory_order_relaxed)) return;
+        m_running = true;
+        for (int i = 0; i < m_workerCount; i++) {
+            m_workers.emplace_back([this] { WorkerLoop(); });
+        }
+        m_started.store(true, std::memory_order_release);
+    }
+
+    void WorkerLoop() {
+        HydrationRequest req;
+        for (;;) {
+            if (TakeNext(req)) {
+                Dispatch(req);
+                continue;
+            }
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            if (!m_running) return;
+            m_wake.wait_for(lock, std::chrono::milliseconds(100));
+            if (!m_running) return;
+        }
+    }
+
+    // Strict interactive-over-bulk order, except that bulk work which has
+    // aged past kBulkAgingMs jumps the queue.
+    bool TakeNext(HydrationRequest &req) {
+        if (TryDequeueBulk(req, /*onlyAged=*/true)) return true;
+        if (m_queue.TryDequeue(req)) return true;
+        return TryDequeueBulk(req, /*onlyAged=*/false);
+    }
+
+    bool TryDequeueBulk(HydrationRequest &req, bool onlyAged) {
+        std::lock_guard<std::mutex> lock(m_bulkMutex);
+        if (m_bulk.empty()) return false;
+        if (onlyAged &&
+            GetTickCount64() - m_bulk.front().first < kBulkAgingMs) {
+            return false;
+        }
+        req = std::move(m_bulk.front().second);
+        m_bulk.pop_front();
+        return true;
+    }
+
+    static void Dispatch(HydrationRequest &req) {
+        RecordStage(kStageQueueWait, NowMicros() - req.enqueuedUs);
+        // Cancelled while queued (handle closed mid-hydration, Explorer gave
+        // up on a thumbnail): drop the request before paying for cache reads
+        // or a Go round trip.
+        if (RangeTracker::Instance().Cancelled(req.connKey,
+                                               req.transferKey.QuadPart)) {
+            RangeTracker::Instance().Complete(req.connKey,
+                                              req.transferKey.QuadPart);
+            return;
+        }
+        // Cached blocks complete locally; only the remainder pays for a Go
+        // round trip.  A fully cached range ends the transfer here.
+        if (ServeCachedPrefix(req)) {
+            RangeTracker::Instance().Complete(req.connKey,
+                                              req.transferKey.QuadPart);
+            return;
+        }
+        SHIM_TRACE_BEGIN("go_dispatch", req.transferKey.QuadPart);
+        long long start = NowMicros();
+        goHydrationCallbackForRoot(req.rootId, req.identity.c_str(),
+                                   static_cast<int>(req.identity.size()),
+                                   req.offset, req.length, req.transferKey);
+        long long elapsed = NowMicros() - start;
+        RecordStage(kStageGoDispatch, elapsed);
+        SHIM_TRACE_END("go_dispatch", req.transferKey.QuadPart, elapsed);
+    }
+
+    HydrationQueue m_queue;
+    std::mutex m_bulkMutex;
+    std::deque<std::pair<ULONGLONG, HydrationRequest>> m_bulk;
+    std::vector<std::thread> m_workers;
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wake;
+    std::atomic<bool> m_started{false};
+    bool m_running = false;
+    int m_workerCount = 8;
+};
+
+} /* namespace */
+
+/* ---------- Event Ring ---------- */
+
+// Notify callbacks (rename, delete, open/close, validate) fire at very high
+// rates during bulk local operations; paying a CGO transition per event
+// melted the first prototype.  Instead events are buffered in a fixed ring
+// that Go drains in batches with a single cfapi_poll_events call.
+
+namespace {
+
+// Root path without drive letter ("\Users\x\FruitSalade") for a connection;
+// NormalizedPath is volume-relative, so stripping this prefix yields a
+// root-relative path.
+static std::wstring RootNoDrive(const std::wstring &root) {
+    std::wstring stripped =
+        (root.size() >= 2 && root[1] == L':') ? root.substr(2) : root;
+    while (!stripped.empty() && stripped.back() == L'\\') {
+        stripped.pop_back();
+    }
+    return stripped;
+}
+
+// Strip a connection's sync root prefix from a normalized path, if present.
+static const wchar_t *StripSyncRoot(const ConnectionContext *ctx,
+                                    const wchar_t *path) {
+    if (!path) return L"";
+    if (!ctx) return path;
+    size_t rootLen = ctx->rootNoDrive.size();
+    if (rootLen > 0 &&
+        _wcsnicmp(path, ctx->rootNoDrive.c_str(), rootLen) == 0) {
+        const wchar_t *rest = path + rootLen;
+        if (*rest == L'\\') rest++;
+        return rest;
+    }
+    return path;
+}
+
+static void CopyPathUtf8(char *dst, size_t cap, const wchar_t *src) {
+    dst[0] = '\0';
+    if (!src || !*src) return;
+    std::string utf8 = WideToUtf8(src, -1);
+    // WideToUtf8 with -1 includes the terminator in the conversion length.
+    size_t len = strnlen(utf8.c_str(), utf8.size());
+    if (len >= cap) len = cap - 1;
+    memcpy(dst, utf8.c_str(), len);
+    dst[len] = '\0';
+}
+
+class EventRing {
+public:
+    static EventRing &Instance() {
+        static EventRing s_instance;
+        return s_instance;
+    }
+
+    void Push(const CF_CALLBACK_INFO *info, int type, unsigned int flags,
+              long long size, const wchar_t *path, const wchar_t *targetPath)
+    {
+        const ConnectionContext *ctx = ContextFromCallback(info);
+
+        cfapi_event ev;
+        ev.root_id = ctx ? ctx->rootId : 0;
+        ev.type = type;
+        ev.flags = flags;
+        ev.size = size;
+        CopyPathUtf8(ev.path, sizeof(ev.path), StripSyncRoot(ctx, path));
+        CopyPathUtf8(ev.target_path, sizeof(ev.target_path),
+                     StripSyncRoot(ctx, targetPath));
+        Enqueue(ev);
+    }
+
+    // Events observed outside a CfAPI callback (the pin watcher) enter the
+    // ring with an explicit root ID and root-relative path.
+    void PushRaw(int rootId, int type, unsigned int flags, long long size,
+                 const wchar_t *relPath)
+    {
+        cfapi_event ev;
+        ev.root_id = rootId;
+        ev.type = type;
+        ev.flags = flags;
+        ev.size = size;
+        CopyPathUtf8(ev.path, sizeof(ev.path), relPath ? relPath : L"");
+        ev.target_path[0] = '\0';
+        Enqueue(ev);
+    }
+
+    int Poll(cfapi_event *buf, int max) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        int n = m_count < max ? m_count : max;
+        for (int i = 0; i < n; i++) {
+            buf[i] = m_ring[m_head];
+            m_head = (m_head + 1) % kCapacity;
+            m_count--;
+        }
+        return n;
+    }
+
+    long long Dropped() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_dropped;
+    }
+
+private:
+    static const int kCapacity = 4096;
+
+    EventRing() : m_ring(kCapacity) {}
+
+    void Enqueue(const cfapi_event &ev) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_count == kCapacity) {
+            m_dropped++;
+            return;
+        }
+        m_ring[(m_head + m_count) % kCapacity] = ev;
+        m_count++;
+    }
+
+    std::mutex m_mutex;
+    std::vector<cfapi_event> m_ring;
+    int m_head = 0;
+    int m_count = 0;
+    long long m_dropped = 0;
+};
+
+// Acknowledge a rename/delete notification so the local operation proceeds.
+// Local changes are reconciled with the server by the Go side afterwards.
+static void AckNotify(const CF_CALLBACK_INFO *info, CF_OPERATION_TYPE type) {
+    CF_OPERATION_INFO opInfo = {};
+    opInfo.StructSize = sizeof(opInfo);
+    opInfo.Type = type;
+    opInfo.ConnectionKey = info->ConnectionKey;
+    opInfo.TransferKey = info->TransferKey;
+
+    CF_OPERATION_PARAMETERS opParams = {};
+    if (type == CF_OPERATION_TYPE_ACK_RENAME) {
+        opParams.ParamSize = CF_SIZE_OF_OP_PARAM(AckRename);
+        opParams.AckRename.CompletionStatus = STATUS_SUCCESS;
+    } else {
+        opParams.ParamSize = CF_SIZE_OF_OP_PARAM(AckDelete);
+        opParams.AckDelete.CompletionStatus = STATUS_SUCCESS;
+    }
+    CfExecute(&opInfo, &opParams);
+}
+
+} /* namespace */
+
+/* ---------- Dirty Journal ---------- */
+
+// Local edits used to be discovered by the Go side's coarse refresh
+// machinery.  Each root now keeps a write-back journal in a memory-mapped
+// "<root>.fsdj" file: the root watcher records modified files (path, size,
+// mtime) as they change, coalescing repeated saves of the same file into one
+// slot.  Go drains the journal with cfapi_drain_dirty, uploads, and confirms
+// with cfapi_set_in_sync, which also flips CfSetInSyncState so Explorer
+// shows the synced state.  Because the journal is a mapped file, entries
+// survive a crash and are re-drained on the next start; a drained entry that
+// is never confirmed re-surfaces after a timeout.
+
+namespace {
+
+const unsigned int kJournalMagic = 0x4A445346;  // 'FSDJ'
+const unsigned int kJournalFormatVersion = 1;
+const unsigned int kJournalSlots = 1024;
+const long long kJournalRedrainSecs = 300;  // unconfirmed drains retry
+
+enum JournalSlotState {
+    kJournalFree = 0,
+    kJournalDirty = 1,
+    kJournalDraining = 2,  // handed to Go, awaiting cfapi_set_in_sync
+};
+
+struct JournalHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int slotCount;
+    unsigned int reserved;
+};
+
+struct JournalSlot {
+    unsigned int state;  // JournalSlotState
+    int pathLen;
+    long long size;
+    long long mtimeUnix;
+    long long firstChangeUnix;
+    long long drainUnix;
+    char path[512];  // root-relative, UTF-8, '/'-separated
+};
+
+class DirtyJournal {
+public:
+    DirtyJournal(int rootId, const std::wstring &root)
+        : m_rootId(rootId), m_root(root) {}
+
+    int rootId() const { return m_rootId; }
+    const std::wstring &Root() const { return m_root; }
+
+    HRESULT Open() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        long long fileSize =
+            static_cast<long long>(sizeof(JournalHeader)) +
+            static_cast<long long>(kJournalSlots) * sizeof(JournalSlot);
+
+        for (int attempt = 0; attempt < 2; attempt++) {
+            std::wstring path = m_root + L".fsdj";
+            m_file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                                 0, nullptr, OPEN_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (m_file == INVALID_HANDLE_VALUE) {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            LARGE_INTEGER existing = {};
+            GetFileSizeEx(m_file, &existing);
+            bool fresh = existing.QuadPart == 0;
+
+            m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READWRITE,
+                                           static_cast<DWORD>(fileSize >> 32),
+                                           static_cast<DWORD>(fileSize),
+                                           nullptr);
+            if (m_mapping) {
+                m_header = static_cast<JournalHeader *>(MapViewOfFile(
+                    m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0,
+                    static_cast<SIZE_T>(fileSize)));
+            }
+            if (!m_header) {
+                HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+                CloseLocked();
+                return hr;
+            }
+
+            if (fresh) {
+                memset(m_header, 0, sizeof(*m_header));
+                m_header->magic = kJournalMagic;
+                m_header->version = kJournalFormatVersion;
+                m_header->slotCount = kJournalSlots;
+                return S_OK;
+            }
+            if (m_header->magic == kJournalMagic &&
+                m_header->version == kJournalFormatVersion &&
+                m_header->slotCount == kJournalSlots) {
+                return S_OK;  // surviving entries re-drain after a crash
+            }
+
+            // Corrupt or from an incompatible build: recreate once.  The
+            // refresh machinery still covers whatever the lost entries held.
+            CloseLocked();
+            if (attempt == 0) DeleteFileW(path.c_str());
+        }
+        return E_FAIL;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        CloseLocked();
+    }
+
+    // Record a modified file, coalescing repeated saves into one slot.  A
+    // full journal drops the record; the periodic refresh still catches the
+    // file, it just loses the fast path.
+    void MarkDirty(const char *relPath, int relPathLen, long long size,
+                   long long mtimeUnix)
+    {
+        if (relPathLen <= 0 ||
+            relPathLen >= static_cast<int>(sizeof(JournalSlot::path))) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header) return;
+
+        JournalSlot *slots = Slots();
+        JournalSlot *free_slot = nullptr;
+        for (unsigned int i = 0; i < m_header->slotCount; i++) {
+            JournalSlot *slot = &slots[i];
+            if (slot->state == kJournalFree) {
+                if (!free_slot) free_slot = slot;
+                continue;
+            }
+            if (slot->pathLen == relPathLen &&
+                memcmp(slot->path, relPath, relPathLen) == 0) {
+                slot->size = size;
+                slot->mtimeUnix = mtimeUnix;
+                slot->state = kJournalDirty;  // re-dirty a pending drain
+                return;
+            }
+        }
+        if (!free_slot) return;
+
+        free_slot->pathLen = relPathLen;
+        memcpy(free_slot->path, relPath, relPathLen);
+        free_slot->size = size;
+        free_slot->mtimeUnix = mtimeUnix;
+        free_slot->firstChangeUnix = static_cast<long long>(time(nullptr));
+        free_slot->drainUnix = 0;
+        free_slot->state = kJournalDirty;
+    }
+
+    // Hand up to max dirty records to the caller, marking them as draining.
+    // Drained records stay in the journal until cfapi_set_in_sync confirms
+    // the upload; unconfirmed drains become dirty again after a timeout.
+    int Drain(cfapi_dirty_record *out, int max) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header) return 0;
+
+        long long now = static_cast<long long>(time(nullptr));
+        JournalSlot *slots = Slots();
+        int n = 0;
+        for (unsigned int i = 0; i < m_header->slotCount && n < max; i++) {
+            JournalSlot *slot = &slots[i];
+            bool due = slot->state == kJournalDirty ||
+                       (slot->state == kJournalDraining &&
+                        now - slot->drainUnix > kJournalRedrainSecs);
+            if (!due) continue;
+
+            cfapi_dirty_record &rec = out[n++];
+            rec.root_id = m_rootId;
+            rec.size = slot->size;
+            rec.mtime_unix = slot->mtimeUnix;
+            rec.first_change_unix = slot->firstChangeUnix;
+            memcpy(rec.path, slot->path, slot->pathLen);
+            rec.path[slot->pathLen] = '\0';
+
+            slot->state = kJournalDraining;
+            slot->drainUnix = now;
+        }
+        return n;
+    }
+
+    // Confirmation that the file is uploaded (or was never really dirty).
+    void Clear(const char *relPath, int relPathLen) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header) return;
+        JournalSlot *slots = Slots();
+        for (unsigned int i = 0; i < m_header->slotCount; i++) {
+            JournalSlot *slot = &slots[i];
+            if (slot->state != kJournalFree &&
+                slot->pathLen == relPathLen &&
+                memcmp(slot->path, relPath, relPathLen) == 0) {
+                slot->state = kJournalFree;
+                return;
+            }
+        }
+    }
+
+private:
+    void CloseLocked() {
+        if (m_header) {
+            FlushViewOfFile(m_header, 0);
+            UnmapViewOfFile(m_header);
+            m_header = nullptr;
+        }
+        if (m_mapping) {
+            CloseHandle(m_mapping);
+            m_mapping = nullptr;
+        }
+        if (m_file != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_file);
+            m_file = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    JournalSlot *Slots() {
+        return reinterpret_cast<JournalSlot *>(m_header + 1);
+    }
+
+    int m_rootId;
+    std::wstring m_root;
+    std::mutex m_mutex;
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+    JournalHeader *m_header = nullptr;
+};
+
+static std::mutex s_journalMutex;
+static std::vector<DirtyJournal *> s_journals;
+
+// Journal owning the given root path (exact match), or null.
+static DirtyJournal *JournalForRoot(const std::wstring &root) {
+    std::lock_guard<std::mutex> lock(s_journalMutex);
+    for (DirtyJournal *journal : s_journals) {
+        if (_wcsicmp(journal->Root().c_str(), root.c_str()) == 0) {
+            return journal;
+        }
+    }
+    return nullptr;
+}
+
+// Journal covering an absolute path; also yields the '/'-separated
+// root-relative remainder (mirrors IndexForAbsPath).
+static DirtyJournal *JournalForAbsPath(const std::wstring &absPath,
+                                       std::string *outRel)
+{
+    std::lock_guard<std::mutex> lock(s_journalMutex);
+    for (DirtyJournal *journal : s_journals) {
+        const std::wstring &root = journal->Root();
+        if (absPath.size() <= root.size() + 1) continue;
+        if (_wcsnicmp(absPath.c_str(), root.c_str(), root.size()) != 0 ||
+            absPath[root.size()] != L'\\') {
+            continue;
+        }
+        std::wstring rel = absPath.substr(root.size() + 1);
+        for (wchar_t &c : rel) {
+            if (c == L'\\') c = L'/';
+        }
+        *outRel = WideToUtf8(rel.c_str(), static_cast<int>(rel.size()));
+        return journal;
+    }
+    return nullptr;
+}
+
+} /* namespace */
+
+/* ---------- Operation Journal ---------- */
+
+// An unclean shutdown mid-population or mid-diff-apply used to force a full
+// re-walk of the sync root against the metadata tree, because nothing
+// recorded which placeholders had already been touched.  Every mutating
+// placeholder operation now appends a record to a memory-mapped ring log
+// next to the root ("<root>.fsol").  Records are written first and the
+// header's committed sequence is advanced afterwards — once per batch, so
+// bulk work pays one commit per directory (group commit) and a torn batch
+// simply never commits.  Mapped writes survive a process crash without
+// explicit flushes; only an OS crash can lose the last moments, which
+// recovery absorbs by spot-checking the tail.  cfapi_recover reads the
+// committed sequence back, verifies the newest records against the
+// filesystem, and hands Go a resume point so restart picks up in seconds
+// instead of re-walking the tree.
+
+namespace {
+
+const unsigned int kOplogMagic = 0x4C4F5346;  // 'FSOL'
+const unsigned int kOplogFormatVersion = 1;
+const unsigned int kOplogSlots = 4096;
+const unsigned int kOplogVerifyTail = 256;  // records re-checked on recover
+
+struct OplogHeader {
+    unsigned int magic;
+    unsigned int version;
+    unsigned int slotCount;
+    unsigned int reserved;
+    unsigned long long committedSeq;  // highest sequence safe to trust
+};
+
+struct OplogSlot {
+    unsigned long long seq;  // 0 = slot never written
+    unsigned int op;         // CFAPI_OPLOG_*
+    int pathLen;
+    long long size;
+    long long mtimeUnix;
+    char path[512];          // root-relative, UTF-8, '/'-separated
+};
+
+class OpJournal {
+public:
+    explicit OpJournal(const std::wstring &root) : m_root(root) {}
+
+    const std::wstring &Root() const { return m_root; }
+
+    HRESULT Open() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        long long fileSize =
+            static_cast<long long>(sizeof(OplogHeader)) +
+            static_cast<long long>(kOplogSlots) * sizeof(OplogSlot);
+
+        for (int attempt = 0; attempt < 2; attempt++) {
+            std::wstring path = m_root + L".fsol";
+            m_file = CreateFileW(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+                                 0, nullptr, OPEN_ALWAYS,
+                                 FILE_ATTRIBUTE_NORMAL, nullptr);
+            if (m_file == INVALID_HANDLE_VALUE) {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+
+            LARGE_INTEGER existing = {};
+            GetFileSizeEx(m_file, &existing);
+            bool fresh = existing.QuadPart == 0;
+
+            m_mapping = CreateFileMappingW(m_file, nullptr, PAGE_READWRITE,
+                                           static_cast<DWORD>(fileSize >> 32),
+                                           static_cast<DWORD>(fileSize),
+                                           nullptr);
+            if (m_mapping) {
+                m_header = static_cast<OplogHeader *>(MapViewOfFile(
+                    m_mapping, FILE_MAP_READ | FILE_MAP_WRITE, 0, 0,
+                    static_cast<SIZE_T>(fileSize)));
+            }
+            if (!m_header) {
+                HRESULT hr = HRESULT_FROM_WIN32(GetLastError());
+                CloseLocked();
+                return hr;
+            }
+
+            if (fresh) {
+                memset(m_header, 0, sizeof(*m_header));
+                m_header->magic = kOplogMagic;
+                m_header->version = kOplogFormatVersion;
+                m_header->slotCount = kOplogSlots;
+                m_lastSeq = 0;
+                return S_OK;
+            }
+            if (m_header->magic == kOplogMagic &&
+                m_header->version == kOplogFormatVersion &&
+                m_header->slotCount == kOplogSlots) {
+                // Uncommitted records from the dead run sit beyond the
+                // committed sequence and are overwritten as if never made.
+                m_lastSeq = m_header->committedSeq;
+                return S_OK;
+            }
+
+            // Corrupt or incompatible: recreate once.  Recovery degrades to
+            // the old full re-walk, nothing is lost but time.
+            CloseLocked();
+            if (attempt == 0) DeleteFileW(path.c_str());
+        }
+        return E_FAIL;
+    }
+
+    void Close() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        CloseLocked();
+    }
+
+    // Append one record without publishing it; Commit makes everything
+    // appended so far recoverable.  Bulk callers append a directory's worth
+    // and commit once.
+    void Append(int op, const char *relPath, int relPathLen, long long size,
+                long long mtimeUnix)
+    {
+        if (relPathLen <= 0 ||
+            relPathLen >= static_cast<int>(sizeof(OplogSlot::path))) {
+            return;
+        }
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header) return;
+
+        unsigned long long seq = ++m_lastSeq;
+        OplogSlot *slot = &Slots()[seq % kOplogSlots];
+        slot->op = static_cast<unsigned int>(op);
+        slot->pathLen = relPathLen;
+        slot->size = size;
+        slot->mtimeUnix = mtimeUnix;
+        memcpy(slot->path, relPath, relPathLen);
+        slot->seq = seq;
+    }
+
+    void Commit() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header) return;
+        m_header->committedSeq = m_lastSeq;
+    }
+
+    // Verify the newest committed records against the filesystem and return
+    // the resume point: the committed sequence, walked back past any tail
+    // records whose effect never reached disk (lost to an OS crash between
+    // the mapped write and writeback).
+    long long Recover() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (!m_header) return 0;
+
+        unsigned long long committed = m_header->committedSeq;
+        unsigned long long resume = committed;
+        unsigned long long window =
+            committed < kOplogVerifyTail ? committed : kOplogVerifyTail;
+        if (window > kOplogSlots) window = kOplogSlots;
+
+        for (unsigned long long seq = committed; seq > committed - window;
+             seq--) {
+            const OplogSlot *slot = &Slots()[seq % kOplogSlots];
+            if (slot->seq != seq) break;  // overwritten by newer laps
+            if (!SlotVerifies(slot)) resume = seq - 1;
+        }
+        return static_cast<long long>(resume);
+    }
+
+private:
+    bool SlotVerifies(const OplogSlot *slot) {
+        std::wstring rel =
+            Utf8ToWide(std::string(slot->path, slot->pathLen).c_str());
+        for (wchar_t &c : rel) {
+            if (c == L'/') c = L'\\';
+        }
+        std::wstring abs = m_root + L'\\' + rel;
+        DWORD attrs = GetFileAttributesW(abs.c_str());
+
+        switch (slot->op) {
+        case CFAPI_OPLOG_CREATE:
+        case CFAPI_OPLOG_UPDATE:
+            return attrs != INVALID_FILE_ATTRIBUTES;
+        case CFAPI_OPLOG_DEHYDRATE:
+            return attrs != INVALID_FILE_ATTRIBUTES &&
+                   (attrs & (FILE_ATTRIBUTE_OFFLINE |
+                             FILE_ATTRIBUTE_RECALL_ON_DATA_ACCESS)) != 0;
+        case CFAPI_OPLOG_DELETE:
+            return attrs == INVALID_FILE_ATTRIBUTES;
+        }
+        return true;
+    }
+
+    void CloseLocked() {
+        if (m_header) {
+            FlushViewOfFile(m_header, 0);
+            UnmapViewOfFile(m_header);
+            m_header = nullptr;
+        }
+        if (m_mapping) {
+            CloseHandle(m_mapping);
+            m_mapping = nullptr;
+        }
+        if (m_file != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_file);
+            m_file = INVALID_HANDLE_VALUE;
+        }
+    }
+
+    OplogSlot *Slots() {
+        return reinterpret_cast<OplogSlot *>(m_header + 1);
+    }
+
+    std::wstring m_root;
+    std::mutex m_mutex;
+    HANDLE m_file = INVALID_HANDLE_VALUE;
+    HANDLE m_mapping = nullptr;
+    OplogHeader *m_header = nullptr;
+    unsigned long long m_lastSeq = 0;
+};
+
+static std::mutex s_oplogMutex;
+static std::vector<OpJournal *> s_oplogs;
+
+// Operation journal owning the given root path (exact match), or null.
+static OpJournal *OplogForRoot(const std::wstring &root) {
+    std::lock_guard<std::mutex> lock(s_oplogMutex);
+    for (OpJournal *oplog : s_oplogs) {
+        if (_wcsicmp(oplog->Root().c_str(), root.c_str()) == 0) {
+            return oplog;
+        }
+    }
+    return nullptr;
+}
+
+// Operation journal covering an absolute path; also yields the
+// '/'-separated root-relative remainder (mirrors JournalForAbsPath).
+static OpJournal *OplogForAbsPath(const std::wstring &absPath,
+                                  std::string *outRel)
+{
+    std::lock_guard<std::mutex> lock(s_oplogMutex);
+    for (OpJournal *oplog : s_oplogs) {
+        const std::wstring &root = oplog->Root();
+        if (absPath.size() <= root.size() + 1) continue;
+        if (_wcsnicmp(absPath.c_str(), root.c_str(), root.size()) != 0 ||
+            absPath[root.size()] != L'\\') {
+            continue;
+        }
+        std::wstring rel = absPath.substr(root.size() + 1);
+        for (wchar_t &c : rel) {
+            if (c == L'\\') c = L'/';
+        }
+        *outRel = WideToUtf8(rel.c_str(), static_cast<int>(rel.size()));
+        return oplog;
+    }
+    return nullptr;
+}
+
+// Record one standalone mutating op by absolute path (append + commit).
+static void OplogRecordAbs(const std::wstring &absPath, int op,
+                           long long size, long long mtimeUnix)
+{
+    std::string rel;
+    OpJournal *oplog = OplogForAbsPath(absPath, &rel);
+    if (!oplog) return;
+    oplog->Append(op, rel.data(), static_cast<int>(rel.size()), size,
+                  mtimeUnix);
+    oplog->Commit();
+}
+
+} /* namespace */
+
+/* ---------- Root Watcher ---------- */
+
+// Explorer's "Always keep on this device" toggles FILE_ATTRIBUTE_PINNED, but
+// no CfAPI callback reports it, so the tray app used to poll attributes over
+// the whole tree every five minutes.  Each connection now runs a watcher
+// thread on recursive directory change notifications: a pin transition
+// starts subtree hydration on a background thread within milliseconds and
+// surfaces one aggregated CFAPI_EVENT_PIN/UNPIN record through the event
+// ring, and content writes feed the root's dirty journal so uploads don't
+// wait for the next metadata refresh either.
+
+namespace {
+
+// Volume-relative prefixes currently being pin-hydrated.  FETCH_DATA under
+// one of them classifies as bulk regardless of the requesting process, so a
+// pin job cannot starve interactive opens.
+static std::mutex s_pinPrefixMutex;
+static std::vector<std::wstring> s_pinPrefixes;
+
+static bool PinBulkMatch(const wchar_t *normalizedPath) {
+    if (!normalizedPath) return false;
+    std::lock_guard<std::mutex> lock(s_pinPrefixMutex);
+    for (const std::wstring &prefix : s_pinPrefixes) {
+        if (_wcsnicmp(normalizedPath, prefix.c_str(), prefix.size()) == 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void AddPinPrefix(const std::wstring &prefix) {
+    std::lock_guard<std::mutex> lock(s_pinPrefixMutex);
+    s_pinPrefixes.push_back(prefix);
+}
+
+static void RemovePinPrefix(const std::wstring &prefix) {
+    std::lock_guard<std::mutex> lock(s_pinPrefixMutex);
+    for (size_t i = 0; i < s_pinPrefixes.size(); i++) {
+        if (s_pinPrefixes[i] == prefix) {
+            s_pinPrefixes.erase(s_pinPrefixes.begin() + i);
+            return;
+        }
+    }
+}
+
+// Hydrate one placeholder in full; failures are ignored (the file may have
+// been deleted or hydrated by a concurrent open).
+static void HydrateOne(const std::wstring &path) {
+    HANDLE h = CreateFileW(path.c_str(), FILE_READ_ATTRIBUTES,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE |
+                               FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS,
+                           nullptr);
+    if (h == INVALID_HANDLE_VALUE) return;
+    CfHydratePlaceholder(h, 0, -1, CF_HYDRATE_FLAG_NONE, nullptr);
+    CloseHandle(h);
+}
+
+// Depth-first hydration of every dehydrated placeholder under absPath.
+static void HydrateSubtree(const std::wstring &absPath) {
+    DWORD attrs = GetFileAttributesW(absPath.c_str());
+    if (attrs == INVALID_FILE_ATTRIBUTES) return;
+    if (!(attrs & FILE_ATTRIBUTE_DIRECTORY)) {
+        HydrateOne(absPath);
+        return;
+    }
+
+    WIN32_FIND_DATAW fd;
+    HANDLE find = FindFirstFileExW((absPath + L"\\*").c_str(),
+                                   FindExInfoBasic, &fd,
+                                   FindExSearchNameMatch, nullptr,
+                                   FIND_FIRST_EX_LARGE_FETCH);
+    if (find == INVALID_HANDLE_VALUE) return;
+    do {
+        if (wcscmp(fd.cFileName, L".") == 0 ||
+            wcscmp(fd.cFileName, L"..") == 0) {
+            continue;
+        }
+        std::wstring child = absPath + L"\\" + fd.cFileName;
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            HydrateSubtree(child);
+        } else if (fd.dwFileAttributes & (FILE_ATTRIBUTE_OFFLINE |
+                                          FILE_ATTRIBUTE_RECALL_ON_DATA_ACCESS)) {
+            HydrateOne(child);
+        }
+    } while (FindNextFileW(find, &fd));
+    FindClose(find);
+}
+
+class RootWatcher {
+public:
+    RootWatcher(int rootId, const std::wstring &root)
+        : m_rootId(rootId), m_root(root), m_rootNoDrive(RootNoDrive(root)) {}
+
+    ~RootWatcher() { Stop(); }
+
+    bool Start() {
+        m_dir = CreateFileW(m_root.c_str(), FILE_LIST_DIRECTORY,
+                            FILE_SHARE_READ | FILE_SHARE_WRITE |
+                                FILE_SHARE_DELETE,
+                            nullptr, OPEN_EXISTING,
+                            FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+        if (m_dir == INVALID_HANDLE_VALUE) return false;
+        m_running.store(true, std::memory_order_release);
+        m_thread = std::thread([this] { WatchLoop(); });
+        return true;
+    }
+
+    void Stop() {
+        if (!m_running.exchange(false)) return;
+        // Closing the directory handle fails the blocked
+        // ReadDirectoryChangesW and unblocks the watcher thread.
+        if (m_dir != INVALID_HANDLE_VALUE) {
+            CloseHandle(m_dir);
+            m_dir = INVALID_HANDLE_VALUE;
+        }
+        if (m_thread.joinable()) m_thread.join();
+    }
+
+private:
+    void WatchLoop() {
+        std::vector<unsigned char> buf(64 * 1024);
+        while (m_running.load(std::memory_order_acquire)) {
+            DWORD returned = 0;
+            if (!ReadDirectoryChangesW(m_dir, buf.data(),
+                                       static_cast<DWORD>(buf.size()), TRUE,
+                                       FILE_NOTIFY_CHANGE_ATTRIBUTES |
+                                           FILE_NOTIFY_CHANGE_LAST_WRITE |
+                                           FILE_NOTIFY_CHANGE_SIZE |
+                                           FILE_NOTIFY_CHANGE_FILE_NAME,
+                                       &returned, nullptr, nullptr)) {
+                return;  // handle closed by Stop, or the root went away
+            }
+            if (returned == 0) continue;  // overflow: transitions re-observed
+
+            const FILE_NOTIFY_INFORMATION *info =
+                reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(buf.data());
+            for (;;) {
+                std::wstring rel(info->FileName,
+                                 info->FileNameLength / sizeof(WCHAR));
+                switch (info->Action) {
+                case FILE_ACTION_MODIFIED:
+                    CheckTransition(rel);
+                    MarkDirty(rel);
+                    break;
+                case FILE_ACTION_ADDED:
+                case FILE_ACTION_RENAMED_NEW_NAME:
+                    MarkDirty(rel);
+                    break;
+                default:
+                    break;
+                }
+                if (info->NextEntryOffset == 0) break;
+                info = reinterpret_cast<const FILE_NOTIFY_INFORMATION *>(
+                    reinterpret_cast<const unsigned char *>(info) +
+                    info->NextEntryOffset);
+            }
+        }
+    }
+
+    // Feed a content change into the root's dirty journal.  Hydrations also
+    // write placeholders locally, but they leave size and mtime matching the
+    // metadata tree, so the Go drain loop filters them out the same way it
+    // already filters close events.
+    void MarkDirty(const std::wstring &rel) {
+        DirtyJournal *journal = JournalForRoot(m_root);
+        if (!journal) return;
+
+        std::wstring abs = m_root + L"\\" + rel;
+        WIN32_FIND_DATAW fd;
+        HANDLE find = FindFirstFileExW(abs.c_str(), FindExInfoBasic, &fd,
+                                       FindExSearchNameMatch, nullptr, 0);
+        if (find == INVALID_HANDLE_VALUE) return;
+        FindClose(find);
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) return;
+
+        std::wstring relSlashes = rel;
+        for (wchar_t &c : relSlashes) {
+            if (c == L'\\') c = L'/';
+        }
+        std::string relUtf8 = WideToUtf8(relSlashes.c_str(),
+                                         static_cast<int>(relSlashes.size()));
+        long long size =
+            (static_cast<long long>(fd.nFileSizeHigh) << 32) | fd.nFileSizeLow;
+        journal->MarkDirty(relUtf8.c_str(), static_cast<int>(relUtf8.size()),
+                           size, FileTimeToUnix(fd.ftLastWriteTime));
+    }
+
+    // Compare the current pin attribute against the last observed state and
+    // act only on the edge, so attribute noise (timestamps, archive bit)
+    // costs one GetFileAttributesW and a set lookup.
+    void CheckTransition(const std::wstring &rel) {
+        std::wstring abs = m_root + L"\\" + rel;
+        DWORD attrs = GetFileAttributesW(abs.c_str());
+        if (attrs == INVALID_FILE_ATTRIBUTES) {
+            m_pinned.erase(rel);
+            return;
+        }
+
+        bool pinned = (attrs & FILE_ATTRIBUTE_PINNED) != 0;
+        bool wasPinned = m_pinned.count(rel) != 0;
+        if (pinned == wasPinned) return;
+
+        if (pinned) {
+            m_pinned.insert(rel);
+            EventRing::Instance().PushRaw(m_rootId, CFAPI_EVENT_PIN, 0, 0,
+                                          rel.c_str());
+            // Hydrate off-thread so a large subtree never blocks the
+            // watcher; the prefix keeps its FETCH_DATA in the bulk lane.
+            std::wstring prefix = m_rootNoDrive + L"\\" + rel;
+            AddPinPrefix(prefix);
+            std::thread([abs, prefix] {
+                HydrateSubtree(abs);
+                RemovePinPrefix(prefix);
+            }).detach();
+        } else {
+            m_pinned.erase(rel);
+            EventRing::Instance().PushRaw(m_rootId, CFAPI_EVENT_UNPIN, 0, 0,
+                                          rel.c_str());
+        }
+    }
+
+    int m_rootId;
+    std::wstring m_root;
+    std::wstring m_rootNoDrive;
+    HANDLE m_dir = INVALID_HANDLE_VALUE;
+    std::thread m_thread;
+    std::atomic<bool> m_running{false};
+    std::unordered_set<std::wstring> m_pinned;  // watcher thread only
+};
+
+} /* namespace */
+
+/* ---------- Local Content Validation ---------- */
+
+// V2 identity blobs ("FSI2|<file-id>|<sha256-hex>") carry the server's
+// whole-file content hash alongside the file ID, so VALIDATE_DATA can be
+// answered by hashing the local bytes instead of acking blindly or paying a
+// server round trip per range.  An integrity scan over the sync root then
+// costs disk bandwidth, not network.  Hashing runs on the callback thread,
+// which is acceptable because the verdict cache below bounds the work to
+// one pass per file per scan; partially hydrated files fall back to the old
+// ack-as-valid behaviour, since a whole-file hash cannot vouch for a sparse
+// range.
+
+namespace {
+
+// Extract the hex digest from a v2 identity blob.  Returns false for v1
+// blobs (bare file IDs), which carry no hash material.
+bool ParseIdentityHash(const void *identity, DWORD length, std::string *hex) {
+    const char *bytes = static_cast<const char *>(identity);
+    if (!bytes) return false;
+    size_t n = length;
+    while (n > 0 && bytes[n - 1] == '\0') n--;  // blob may be NUL-padded
+    if (n < 6 || memcmp(bytes, "FSI2|", 5) != 0) return false;
+    size_t sep = 0;
+    for (size_t i = n; i-- > 5;) {
+        if (bytes[i] == '|') { sep = i; break; }
+    }
+    if (sep < 5 || sep + 1 >= n) return false;
+    hex->assign(bytes + sep + 1, n - sep - 1);
+    return hex->size() == 64;
+}
+
+// Stream a file through CNG SHA-256 (the server hashes uploads with the
+// same algorithm).  The algorithm handle is opened once and reused; hash
+// objects created from it are independent, so this is thread-safe.
+bool Sha256File(const std::wstring &path, unsigned char digest[32]) {
+    static BCRYPT_ALG_HANDLE s_alg = [] {
+        BCRYPT_ALG_HANDLE alg = nullptr;
+        BCryptOpenAlgorithmProvider(&alg, BCRYPT_SHA256_ALGORITHM, nullptr, 0);
+        return alg;
+    }();
+    if (!s_alg) return false;
+
+    HANDLE file = CreateFileW(path.c_str(), GENERIC_READ,
+                              FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+                              OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN,
+                              nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    BCRYPT_HASH_HANDLE hash = nullptr;
+    if (!BCRYPT_SUCCESS(
+            BCryptCreateHash(s_alg, &hash, nullptr, 0, nullptr, 0, 0))) {
+        CloseHandle(file);
+        return false;
+    }
+
+    std::vector<unsigned char> buf(1024 * 1024);
+    bool ok = true;
+    for (;;) {
+        DWORD read = 0;
+        if (!ReadFile(file, buf.data(), static_cast<DWORD>(buf.size()), &read,
+                      nullptr)) {
+            ok = false;
+            break;
+        }
+        if (read == 0) break;
+        if (!BCRYPT_SUCCESS(BCryptHashData(hash, buf.data(), read, 0))) {
+            ok = false;
+            break;
+        }
+    }
+    if (ok) ok = BCRYPT_SUCCESS(BCryptFinishHash(hash, digest, 32, 0));
+    BCryptDestroyHash(hash);
+    CloseHandle(file);
+    return ok;
+}
+
+// Case-insensitive compare of a 64-char hex string against a raw digest.
+bool HexMatchesDigest(const std::string &hex, const unsigned char digest[32]) {
+    static const char kDigits[] = "0123456789abcdef";
+    if (hex.size() != 64) return false;
+    for (int i = 0; i < 32; i++) {
+        char a = hex[2 * i], b = hex[2 * i + 1];
+        if (a >= 'A' && a <= 'F') a += 'a' - 'A';
+        if (b >= 'A' && b <= 'F') b += 'a' - 'A';
+        if (a != kDigits[digest[i] >> 4] || b != kDigits[digest[i] & 0xF])
+            return false;
+    }
+    return true;
+}
+
+// One verdict per identity blob: the hash names the exact content, so a
+// cached result only goes stale when the placeholder is updated to a new
+// blob, which changes the key.  Hash failures (file locked, CNG error) are
+// not cached; those are "could not verify", not "corrupt".
+std::mutex s_validateMutex;
+std::unordered_map<std::string, bool> s_validateVerdicts;
+
+// Returns 1 on match, 0 on mismatch, -1 when the file could not be hashed.
+int ContentMatchesIdentity(const std::wstring &absPath,
+                           const std::string &blobKey,
+                           const std::string &hashHex) {
+    {
+        std::lock_guard<std::mutex> lock(s_validateMutex);
+        auto it = s_validateVerdicts.find(blobKey);
+        if (it != s_validateVerdicts.end()) return it->second ? 1 : 0;
+    }
+
+    unsigned char digest[32];
+    if (!Sha256File(absPath, digest)) return -1;
+    bool match = HexMatchesDigest(hashHex, digest);
+
+    std::lock_guard<std::mutex> lock(s_validateMutex);
+    if (s_validateVerdicts.size() >= 65536) s_validateVerdicts.clear();
+    s_validateVerdicts[blobKey] = match;
+    return match ? 1 : 0;
+}
+
+} /* namespace */
+
+/* ---------- Enumeration Header Prefetch ---------- */
+
+// Explorer's first act after enumerating a folder of dehydrated images is to
+// read the head of every file for thumbnails — one synchronous server round
+// trip per file.  Directory opens and FETCH_PLACEHOLDERS therefore kick a
+// batched head prefetch on the Go side, which fetches the leading bytes of
+// the whole directory in one server call and stages them in the block cache
+// via cfapi_stage_header, so the FETCH_DATA storm that follows is served
+// locally.  A per-directory cooldown keeps Explorer's habit of reopening the
+// same folder several times per browse from repeating the batch.
+
+const long long kPrefetchCooldownUs = 30LL * 1000 * 1000;
+
+static std::mutex s_prefetchMutex;
+static std::unordered_map<std::wstring, long long> s_prefetchLastUs;
+
+static void MaybePrefetchDirectory(const CF_CALLBACK_INFO *callbackInfo) {
+    std::wstring key;
+    if (callbackInfo->NormalizedPath) key = callbackInfo->NormalizedPath;
+
+    long long now = NowMicros();
+    {
+        std::lock_guard<std::mutex> lock(s_prefetchMutex);
+        auto it = s_prefetchLastUs.find(key);
+        if (it != s_prefetchLastUs.end() &&
+            now - it->second < kPrefetchCooldownUs) {
+            return;
+        }
+        // Unbounded growth is pointless for a cooldown map; dropping it
+        // wholesale just means one extra prefetch per directory.
+        if (s_prefetchLastUs.size() >= 4096) s_prefetchLastUs.clear();
+        s_prefetchLastUs[key] = now;
+    }
+
+    // The Go side resolves the directory from its identity and runs the
+    // batched fetch on its own goroutine; this returns immediately.
+    goPrefetchHeadersCallbackForRoot(
+        RootIdFromCallback(callbackInfo),
+        static_cast<const char *>(callbackInfo->FileIdentity),
+        static_cast<int>(callbackInfo->FileIdentityLength));
+}
+
+static void CALLBACK NotifyRenameCallback(
+    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
+    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
+{
+    EventRing::Instance().Push(callbackInfo, CFAPI_EVENT_RENAME,
+                               callbackParameters->Rename.Flags,
+                               callbackInfo->FileSize.QuadPart,
+                               callbackInfo->NormalizedPath,
+                               callbackParameters->Rename.TargetPath);
+    AckNotify(callbackInfo, CF_OPERATION_TYPE_ACK_RENAME);
+}
+
+static void CALLBACK NotifyRenameCompletionCallback(
+    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
+    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
+{
+    EventRing::Instance().Push(callbackInfo, CFAPI_EVENT_RENAME_COMPLETION,
+                               callbackParameters->RenameCompletion.Flags,
+                               callbackInfo->FileSize.QuadPart,
+                               callbackInfo->NormalizedPath,
+                               callbackParameters->RenameCompletion.SourcePath);
+}
+
+static void CALLBACK NotifyDeleteCallback(
+    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
+    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
+{
+    EventRing::Instance().Push(callbackInfo, CFAPI_EVENT_DELETE,
+                               callbackParameters->Delete.Flags,
+                               callbackInfo->FileSize.QuadPart,
+                               callbackInfo->NormalizedPath, nullptr);
+    AckNotify(callbackInfo, CF_OPERATION_TYPE_ACK_DELETE);
+}
+
+static void CALLBACK NotifyDeleteCompletionCallback(
+    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
+    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
+{
+    EventRing::Instance().Push(callbackInfo, CFAPI_EVENT_DELETE_COMPLETION,
+                               callbackParameters->DeleteCompletion.Flags,
+                               callbackInfo->FileSize.QuadPart,
+                               callbackInfo->NormalizedPath, nullptr);
+}
+
+static void CALLBACK NotifyFileOpenCompletionCallback(
+    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
+    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
+{
+    EventRing::Instance().Push(callbackInfo, CFAPI_EVENT_FILE_OPEN,
+                               callbackParameters->OpenCompletion.Flags,
+                               callbackInfo->FileSize.QuadPart,
+                               callbackInfo->NormalizedPath, nullptr);
+
+    // A directory open is the leading edge of an Explorer enumeration on a
+    // fully populated root (where FETCH_PLACEHOLDERS never fires); file
+    // opens are not interesting to the prefetcher.
+    std::wstring abs;
+    if (callbackInfo->VolumeDosName) abs = callbackInfo->VolumeDosName;
+    if (callbackInfo->NormalizedPath) abs += callbackInfo->NormalizedPath;
+    DWORD attrs = abs.empty() ? INVALID_FILE_ATTRIBUTES
+                              : GetFileAttributesW(abs.c_str());
+    if (attrs != INVALID_FILE_ATTRIBUTES &&
+        (attrs & FILE_ATTRIBUTE_DIRECTORY)) {
+        MaybePrefetchDirectory(callbackInfo);
+    }
+}
+
+static void CALLBACK NotifyFileCloseCompletionCallback(
+    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
+    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
+{
+    EventRing::Instance().Push(callbackInfo, CFAPI_EVENT_FILE_CLOSE,
+                               callbackParameters->CloseCompletion.Flags,
+                               callbackInfo->FileSize.QuadPart,
+                               callbackInfo->NormalizedPath, nullptr);
+}
+
+static void CALLBACK ValidateDataCallback(
+    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
+    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
+{
+    EventRing::Instance().Push(callbackInfo, CFAPI_EVENT_VALIDATE,
+                               callbackParameters->ValidateData.Flags,
+                               callbackParameters->ValidateData.RequiredLength.QuadPart,
+                               callbackInfo->NormalizedPath, nullptr);
+
+    // With a v2 identity and fully resident content, verify locally against
+    // the server hash carried in the blob.  Everything else (v1 blobs,
+    // partial placeholders, unreadable files) is acked as valid rather than
+    // forcing a server round trip, matching the pre-v2 behaviour.
+    NTSTATUS status = STATUS_SUCCESS;
+    std::string hashHex;
+    if (ParseIdentityHash(callbackInfo->FileIdentity,
+                          callbackInfo->FileIdentityLength, &hashHex)) {
+        std::wstring abs;
+        if (callbackInfo->VolumeDosName) abs = callbackInfo->VolumeDosName;
+        if (callbackInfo->NormalizedPath) abs += callbackInfo->NormalizedPath;
+
+        DWORD attrs = abs.empty() ? INVALID_FILE_ATTRIBUTES
+                                  : GetFileAttributesW(abs.c_str());
+        bool resident =
+            attrs != INVALID_FILE_ATTRIBUTES &&
+            (attrs & (FILE_ATTRIBUTE_OFFLINE |
+                      FILE_ATTRIBUTE_RECALL_ON_DATA_ACCESS)) == 0;
+        if (resident) {
+            std::string blobKey(
+                static_cast<const char *>(callbackInfo->FileIdentity),
+                callbackInfo->FileIdentityLength);
+            if (ContentMatchesIdentity(abs, blobKey, hashHex) == 0)
+                status = STATUS_UNSUCCESSFUL;
+        }
+    }
+
+    CF_OPERATION_INFO opInfo = {};
+    opInfo.StructSize = sizeof(opInfo);
+    opInfo.Type = CF_OPERATION_TYPE_ACK_DATA;
+    opInfo.ConnectionKey = callbackInfo->ConnectionKey;
+    opInfo.TransferKey = callbackInfo->TransferKey;
+
+    CF_OPERATION_PARAMETERS opParams = {};
+    opParams.ParamSize = CF_SIZE_OF_OP_PARAM(AckData);
+    opParams.AckData.CompletionStatus = status;
+    opParams.AckData.Offset = callbackParameters->ValidateData.RequiredFileOffset;
+    opParams.AckData.Length = callbackParameters->ValidateData.RequiredLength;
+    CfExecute(&opInfo, &opParams);
+}
+
+/* ---------- Hydration Callback ---------- */
+
+// This callback is invoked by CfAPI when Explorer or an application reads a
+// placeholder file.  We hand the request to the dispatcher, which calls Go
+// via goHydrationCallback from a worker thread; the filter thread returns
+// immediately so concurrent hydrations don't serialize behind Go dispatch.
+static void CALLBACK FetchDataCallback(
+    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
+    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
+{
+    long long offset = callbackParameters->FetchData.RequiredFileOffset.QuadPart;
+    long long length = callbackParameters->FetchData.RequiredLength.QuadPart;
+
+    // Admission control runs before any range state exists: a denied request
+    // is completed with a retryable timeout and leaves no tracking behind,
+    // so the kernel's retry goes through the same gate with a fuller bucket.
+    if (!AdmissionController::Instance().Admit(
+            ProcessImageName(callbackInfo),
+            static_cast<long long>(callbackInfo->ConnectionKey),
+            callbackInfo->TransferKey.QuadPart, length)) {
+        cfapi_transfer_error(
+            callbackInfo->ConnectionKey, callbackInfo->TransferKey, offset,
+            static_cast<long>(STATUS_CLOUD_FILE_REQUEST_TIMEOUT));
+        return;
+    }
+
+    // Coalesce with in-flight work and apply readahead before paying for a
+    // Go dispatch; a request already covered by a running transfer is free.
+    long long dispatchOffset = 0;
+    long long dispatchLength = 0;
+    if (!RangeTracker::Instance().Plan(callbackInfo->ConnectionKey,
+                                       callbackInfo->TransferKey.QuadPart,
+                                       offset, length,
+                                       callbackInfo->FileSize.QuadPart,
+                                       &dispatchOffset, &dispatchLength)) {
+        return;
+    }
+
+    // Large ranges are striped across workers: each sub-range gets its own
+    // dispatch and transfer session, so stripes stream into CfExecute
+    // independently and out of order while their siblings still download.
+    long long stripeLen = dispatchLength;
+    int stripes = 1;
+    long long threshold = s_stripeThreshold.load(std::memory_order_relaxed);
+    int maxStripes = s_maxStripes.load(std::memory_order_relaxed);
+    if (threshold > 0 && maxStripes > 1 && dispatchLength >= threshold) {
+        stripeLen = s_stripeSize.load(std::memory_order_relaxed);
+        // Size stripes to the link: on slow links smaller stripes complete
+        // sooner, so stalled bytes block Explorer for seconds, not minutes.
+        long long budget = BandwidthGovernor::Instance().RangeBudget();
+        if (stripeLen > budget) stripeLen = budget;
+        if ((dispatchLength + stripeLen - 1) / stripeLen > maxStripes) {
+            // Even split across the stripe budget, rounded up to 4 KB so
+            // every boundary keeps CfExecute's offset alignment.
+            stripeLen = (dispatchLength + maxStripes - 1) / maxStripes;
+            stripeLen = (stripeLen + 0xFFF) & ~0xFFFLL;
+        }
+        stripes = static_cast<int>((dispatchLength + stripeLen - 1) / stripeLen);
+    }
+    if (stripes > 1) {
+        RangeTracker::Instance().Retain(callbackInfo->ConnectionKey,
+                                        callbackInfo->TransferKey.QuadPart,
+                                        stripes - 1);
+    }
+
+    int priority = ClassifyProcess(callbackInfo);
+    // Reads belonging to an in-progress pin hydration take the bulk lane no
+    // matter which process issues them.
+    if (priority == kPriorityInteractive &&
+        PinBulkMatch(callbackInfo->NormalizedPath)) {
+        priority = kPriorityBulk;
+    }
+    for (int i = 0; i < stripes; i++) {
+        HydrationRequest req;
+        req.rootId = RootIdFromCallback(callbackInfo);
+        // Copy the file identity (our file ID stored as a UTF-8 string blob);
+        // callbackInfo is only valid for the duration of this callback.
+        req.identity.assign(static_cast<const char *>(callbackInfo->FileIdentity),
+                            callbackInfo->FileIdentityLength);
+        req.offset = dispatchOffset + static_cast<long long>(i) * stripeLen;
+        long long remaining = dispatchOffset + dispatchLength - req.offset;
+        req.length = remaining < stripeLen ? remaining : stripeLen;
+        req.transferKey = callbackInfo->TransferKey;
+        req.connKey = callbackInfo->ConnectionKey;
+
+        HydrationDispatcher::Instance().Submit(std::move(req), priority);
+    }
+}
+
+// Invoked when Explorer first enumerates a directory under a sync root
+// registered with partial population.  Dispatched synchronously: the Go side
+// answers from its in-memory metadata tree and completes the enumeration via
+// cfapi_fetch_placeholders_complete.
+static void CALLBACK FetchPlaceholdersCallback(
+    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
+    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
+{
+    // The directory's identity is the node ID we stored at creation; the
+    // sync root itself carries no identity and maps to the tree root.
+    const char *dirIdentity = static_cast<const char *>(callbackInfo->FileIdentity);
+    int dirIdentityLen = static_cast<int>(callbackInfo->FileIdentityLength);
+
+    goFetchPlaceholdersCallbackForRoot(RootIdFromCallback(callbackInfo),
+                                       dirIdentity, dirIdentityLen,
+                                       callbackInfo->TransferKey,
+                                       callbackInfo->ConnectionKey);
+
+    // The enumeration that triggered this is almost always followed by a
+    // thumbnail read storm over the new placeholders; warm their heads now.
+    MaybePrefetchDirectory(callbackInfo);
+}
+
+// Invoked when the kernel abandons an in-flight hydration (the last handle
+// closed mid-read, or Explorer gave up on a thumbnail).  Marks every session
+// for the transfer key as cancelled — queued stripes are dropped by the
+// dispatcher and further transfer chunks fail fast — and tells Go to cancel
+// the download context so the remaining bytes are never fetched.  On metered
+// links abandoned hydrations were a double-digit share of download traffic.
+static void CALLBACK CancelFetchDataCallback(
+    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
+    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
+{
+    if (!RangeTracker::Instance().Cancel(callbackInfo->ConnectionKey,
+                                         callbackInfo->TransferKey.QuadPart)) {
+        return;  // nothing in flight for this key
+    }
+    goCancelHydrationCallbackForRoot(
+        RootIdFromCallback(callbackInfo),
+        callbackInfo->TransferKey.QuadPart,
+        static_cast<long long>(callbackInfo->ConnectionKey));
+}
+
+// Callback table registered with CfConnectSyncRoot.
+static CF_CALLBACK_REGISTRATION s_callbackTable[] = {
+    { CF_CALLBACK_TYPE_FETCH_DATA,         FetchDataCallback },
+    { CF_CALLBACK_TYPE_CANCEL_FETCH_DATA,  CancelFetchDataCallback },
+    { CF_CALLBACK_TYPE_FETCH_PLACEHOLDERS, FetchPlaceholdersCallback },
+    { CF_CALLBACK_TYPE_VALIDATE_DATA,      ValidateDataCallback },
+    { CF_CALLBACK_TYPE_NOTIFY_RENAME,      NotifyRenameCallback },
+    { CF_CALLBACK_TYPE_NOTIFY_RENAME_COMPLETION, NotifyRenameCompletionCallback },
+    { CF_CALLBACK_TYPE_NOTIFY_DELETE,      NotifyDeleteCallback },
+    { CF_CALLBACK_TYPE_NOTIFY_DELETE_COMPLETION, NotifyDeleteCompletionCallback },
+    { CF_CALLBACK_TYPE_NOTIFY_FILE_OPEN_COMPLETION, NotifyFileOpenCompletionCallback },
+    { CF_CALLBACK_TYPE_NOTIFY_FILE_CLOSE_COMPLETION, NotifyFileCloseCompletionCallback },
+    CF_CALLBACK_REGISTRATION_END
+};
+
+/* ---------- Registration Fingerprint ---------- */
+
+// CfRegisterSyncRoot with CF_REGISTER_FLAG_UPDATE rewrites the registration
+// on every service start, which takes seconds on slow profile disks.  A
+// successful registration persists a fingerprint of everything that went
+// into it (provider GUID, name, version, population policy) beside the root;
+// cfapi_connect_existing compares fingerprints and connects straight away on
+// a match, so warm starts skip the rewrite entirely.
+
+namespace {
+
+const unsigned int kRegMagic = 0x47525346;  // 'FSRG'
+const unsigned int kRegFormatVersion = 1;
+
+struct RegFingerprint {
+    unsigned int magic;
+    unsigned int version;
+    unsigned long long hash;
+};
+
+// FruitSalade's fixed provider GUID, shared by registration and fingerprint.
+// {A1B2C3D4-E5F6-7890-ABCD-EF1234567890}
+static const CLSID s_providerId =
+    { 0xa1b2c3d4, 0xe5f6, 0x7890, { 0xab, 0xcd, 0xef, 0x12, 0x34, 0x56, 0x78, 0x90 } };
+
+static unsigned long long RegHash(const char *name, const char *version) {
+    unsigned long long h =
+        Fnv64(reinterpret_cast<const char *>(&s_providerId),
+              sizeof(s_providerId));
+    if (name) {
+        h ^= Fnv64(name, static_cast<int>(strlen(name)));
+        h *= 0x100000001B3ULL;
+    }
+    if (version) {
+        h ^= Fnv64(version, static_cast<int>(strlen(version)));
+        h *= 0x100000001B3ULL;
+    }
+    h ^= static_cast<unsigned long long>(
+        s_onDemandPopulation.load(std::memory_order_relaxed));
+    return h;
+}
+
+static std::wstring RegFingerprintPath(const std::wstring &root) {
+    return root + L".fsreg";
+}
+
+static void WriteRegFingerprint(const std::wstring &root,
+                                unsigned long long hash)
+{
+    HANDLE h = CreateFileW(RegFingerprintPath(root).c_str(), GENERIC_WRITE, 0,
+                           nullptr, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL,
+                           nullptr);
+    if (h == INVALID_HANDLE_VALUE) return;
+    RegFingerprint fp = { kRegMagic, kRegFormatVersion, hash };
+    DWORD written = 0;
+    WriteFile(h, &fp, sizeof(fp), &written, nullptr);
+    CloseHandle(h);
+}
+
+static bool MatchRegFingerprint(const std::wstring &root,
+                                unsigned long long hash)
+{
+    HANDLE h = CreateFileW(RegFingerprintPath(root).c_str(), GENERIC_READ,
+                           FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+                           FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) return false;
+    RegFingerprint fp = {};
+    DWORD read = 0;
+    BOOL ok = ReadFile(h, &fp, sizeof(fp), &read, nullptr);
+    CloseHandle(h);
+    return ok && read == sizeof(fp) && fp.magic == kRegMagic &&
+           fp.version == kRegFormatVersion && fp.hash == hash;
+}
+
+// Shared tail of both connect entry points: connect the already-registered
+// root, record the connection, start its pin watcher, and announce
+// readiness through the event ring.
+static HRESULT ConnectRegisteredRoot(const std::wstring &wRoot, int root_id,
+                                     CF_CONNECTION_KEY *out_key)
+{
+    ConnectionContext *ctx = new (std::nothrow) ConnectionContext();
+    if (!ctx) return E_OUTOFMEMORY;
+    ctx->rootId = root_id;
+    ctx->rootNoDrive = RootNoDrive(wRoot);
+
+    HRESULT hr = CfConnectSyncRoot(
+        wRoot.c_str(),
+        s_callbackTable,
+        ctx,        // per-connection context; callbacks route by root ID
+        CF_CONNECT_FLAG_REQUIRE_PROCESS_INFO |
+            CF_CONNECT_FLAG_REQUIRE_FULL_FILE_PATH,
+        out_key);
+
+    if (FAILED(hr)) {
+        delete ctx;
+        return hr;
+    }
+
+    // Watch pin attribute transitions so "Always keep on this device"
+    // starts hydrating immediately. Non-fatal: without the watcher, pins
+    // are simply not acted on until the next full scan.
+    ctx->watcher = new (std::nothrow) RootWatcher(root_id, wRoot);
+    if (ctx->watcher && !ctx->watcher->Start()) {
+        delete ctx->watcher;
+        ctx->watcher = nullptr;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(s_connMutex);
+        s_connections[static_cast<long long>(*out_key)] = ctx;
+    }
+    EventRing::Instance().PushRaw(root_id, CFAPI_EVENT_READY, 0, 0, L"");
+    return hr;
+}
+
+} /* namespace */
+
+/* ---------- Directory Handle Cache ---------- */
+
+// During a metadata-sync burst the Go side updates thousands of placeholders
+// under the same few directories, and every absolute CreateFileW pays full
+// path resolution through the filter stack.  Keeping a small LRU of open
+// parent-directory handles and opening children relative to them via
+// NtCreateFile skips re-resolving the parent on every call.  Any failure
+// along the relative path (ntdll lookup, stale parent handle, NT status)
+// falls back to the plain CreateFileW the callers always used, so behaviour
+// and error codes are unchanged.
+
+namespace {
+
+// Just the ntdll surface we need, declared manually: winternl.h drags in
+// definitions that clash with the SDK headers above.  The prototypes are
+// stable public ones.
+typedef struct SHIM_UNICODE_STRING {
+    USHORT Length;
+    USHORT MaximumLength;
+    PWSTR Buffer;
+} SHIM_UNICODE_STRING;
+
+typedef struct SHIM_OBJECT_ATTRIBUTES {
+    ULONG Length;
+    HANDLE RootDirectory;
+    SHIM_UNICODE_STRING *ObjectName;
+    ULONG Attributes;
+    PVOID SecurityDescriptor;
+    PVOID SecurityQualityOfService;
+} SHIM_OBJECT_ATTRIBUTES;
+
+typedef struct SHIM_IO_STATUS_BLOCK {
+    union {
+        NTSTATUS Status;
+        PVOID Pointer;
+    };
+    ULONG_PTR Information;
+} SHIM_IO_STATUS_BLOCK;
+
+typedef NTSTATUS(NTAPI *NtCreateFileFn)(
+    PHANDLE fileHandle, ACCESS_MASK desiredAccess,
+    SHIM_OBJECT_ATTRIBUTES *objectAttributes,
+    SHIM_IO_STATUS_BLOCK *ioStatusBlock, PLARGE_INTEGER allocationSize,
+    ULONG fileAttributes, ULONG shareAccess, ULONG createDisposition,
+    ULONG createOptions, PVOID eaBuffer, ULONG eaLength);
+
+const ULONG kObjCaseInsensitive = 0x00000040;    // OBJ_CASE_INSENSITIVE
+const ULONG kFileOpen = 0x00000001;              // FILE_OPEN
+const ULONG kFileOpenForBackupIntent = 0x00004000;
+
+NtCreateFileFn ResolveNtCreateFile() {
+    static NtCreateFileFn s_fn = [] {
+        HMODULE ntdll = GetModuleHandleW(L"ntdll.dll");
+        return ntdll ? reinterpret_cast<NtCreateFileFn>(
+                           GetProcAddress(ntdll, "NtCreateFile"))
+                     : static_cast<NtCreateFileFn>(nullptr);
+    }();
+    return s_fn;
+}
+
+class HandleCache {
+public:
+    static HandleCache &Instance() {
+        static HandleCache s_instance;
+        return s_instance;
+    }
+
+    // Open absPath relative to its cached parent-directory handle.  Returns
+    // false when the caller should fall back to absolute CreateFileW.  The
+    // lock is held across the child open; update bursts are driven by one
+    // goroutine, so this does not contend in practice.
+    bool OpenRelative(const wchar_t *absPath, ACCESS_MASK access,
+                      HANDLE *outFile) {
+        NtCreateFileFn ntCreateFile = ResolveNtCreateFile();
+        if (!ntCreateFile || !absPath) return false;
+
+        const wchar_t *sep = wcsrchr(absPath, L'\\');
+        if (!sep || sep == absPath || !sep[1]) return false;
+        std::wstring parent(absPath, sep - absPath);
+        size_t childLen = wcslen(sep + 1);
+        if (childLen * sizeof(wchar_t) > 0xFFFF) return false;
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        HANDLE dir = AcquireParentLocked(parent);
+        if (dir == INVALID_HANDLE_VALUE) return false;
+
+        SHIM_UNICODE_STRING name = {};
+        name.Buffer = const_cast<PWSTR>(sep + 1);
+        name.Length = static_cast<USHORT>(childLen * sizeof(wchar_t));
+        name.MaximumLength = name.Length;
+
+        SHIM_OBJECT_ATTRIBUTES attrs = {};
+        attrs.Length = sizeof(attrs);
+        attrs.RootDirectory = dir;
+        attrs.ObjectName = &name;
+        attrs.Attributes = kObjCaseInsensitive;
+
+        SHIM_IO_STATUS_BLOCK iosb = {};
+        HANDLE file = INVALID_HANDLE_VALUE;
+        NTSTATUS status = ntCreateFile(
+            &file, access, &attrs, &iosb, nullptr, 0, FILE_SHARE_READ,
+            kFileOpen, kFileOpenForBackupIntent, nullptr, 0);
+        if (status < 0) {
+            // The parent handle may be stale (directory renamed or deleted
+            // underneath us); drop it so the next call re-opens it.
+            EvictLocked(parent);
+            return false;
+        }
+        *outFile = file;
+        return true;
+    }
+
+    // Close every cached handle.  Must be called before the sync root is
+    // unmounted; lingering directory handles block dismount.
+    void Flush() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto &entry : m_entries) CloseHandle(entry.second.dir);
+        m_entries.clear();
+        m_lru.clear();
+    }
+
+private:
+    struct Entry {
+        HANDLE dir;
+        std::list<std::wstring>::iterator lruIt;
+    };
+
+    HANDLE AcquireParentLocked(const std::wstring &parent) {
+        auto it = m_entries.find(parent);
+        if (it != m_entries.end()) {
+            m_lru.splice(m_lru.begin(), m_lru, it->second.lruIt);
+            return it->second.dir;
+        }
+
+        HANDLE dir = CreateFileW(parent.c_str(), FILE_TRAVERSE,
+                                 FILE_SHARE_READ | FILE_SHARE_WRITE |
+                                     FILE_SHARE_DELETE,
+                                 nullptr, OPEN_EXISTING,
+                                 FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+        if (dir == INVALID_HANDLE_VALUE) return INVALID_HANDLE_VALUE;
+
+        if (m_entries.size() >= kCapacity) {
+            EvictLocked(m_lru.back());
+        }
+        m_lru.push_front(parent);
+        m_entries[parent] = Entry{dir, m_lru.begin()};
+        return dir;
+    }
+
+    void EvictLocked(const std::wstring &parent) {
+        auto it = m_entries.find(parent);
+        if (it == m_entries.end()) return;
+        CloseHandle(it->second.dir);
+        m_lru.erase(it->second.lruIt);
+        m_entries.erase(it);
+    }
+
+    // Bursts touch few distinct directories; keep the cache small so idle
+    // handles don't pin directories against rename/delete for long.
+    static const size_t kCapacity = 16;
+
+    std::mutex m_mutex;
+    std::unordered_map<std::wstring, Entry> m_entries;
+    std::list<std::wstring> m_lru;  // front = most recent
+};
+
+// Open a placeholder for an in-place CfAPI operation: relative open through
+// the handle cache when possible, absolute CreateFileW otherwise.
+static HANDLE OpenPlaceholderForWrite(const wchar_t *wPath) {
+    HANDLE hFile = INVALID_HANDLE_VALUE;
+    if (HandleCache::Instance().OpenRelative(wPath, WRITE_DAC, &hFile)) {
+        return hFile;
+    }
+    return CreateFileW(wPath, WRITE_DAC, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+}
+
+} /* namespace */
+
+/* ---------- Public API ---------- */
+
+extern "C" {
+
+long cfapi_init(void) {
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    // S_OK or S_FALSE (already initialized) are both acceptable.
+    if (FAILED(hr) && hr != RPC_E_CHANGED_MODE) {
+        return static_cast<long>(hr);
+    }
+#ifdef FRUITSALADE_WITH_ETW
+    // Idempotent; the provider stays registered for the process lifetime.
+    TraceLoggingRegister(g_shimTraceProvider);
+#endif
+    return 0;
+}
+
+long cfapi_register_sync_root(const char *sync_root_path,
+                               const char *display_name,
+                               const char *version)
+{
+    std::wstring wRoot = Utf8ToWide(sync_root_path);
+    std::wstring wName = Utf8ToWide(display_name);
+    std::wstring wVer  = Utf8ToWide(version);
+
+    CF_SYNC_REGISTRATION reg = {};
+    reg.StructSize = sizeof(reg);
+    reg.ProviderName = wName.c_str();
+    reg.ProviderVersion = wVer.c_str();
+    reg.ProviderId = s_providerId;
+
+    CF_SYNC_POLICIES policies = {};
+    policies.StructSize = sizeof(policies);
+    policies.Hydration.Primary = CF_HYDRATION_POLICY_FULL;
+    policies.Population.Primary =
+        s_onDemandPopulation.load(std::memory_order_relaxed)
+            ? CF_POPULATION_POLICY_PARTIAL
+            : CF_POPULATION_POLICY_FULL;
+    policies.InSync = CF_INSYNC_POLICY_TRACK_ALL;
+    policies.HardLink = CF_HARDLINK_POLICY_NONE;
+
+    HRESULT hr = CfRegisterSyncRoot(wRoot.c_str(), &reg, &policies,
+                                     CF_REGISTER_FLAG_UPDATE);
+    if (SUCCEEDED(hr)) {
+        // Lets the next start verify nothing changed and skip the rewrite.
+        WriteRegFingerprint(wRoot, RegHash(display_name, version));
+    }
+    return static_cast<long>(hr);
+}
+
+long cfapi_connect_existing(const char *sync_root_path,
+                             const char *display_name,
+                             const char *version,
+                             int root_id,
+                             CF_CONNECTION_KEY *out_key)
+{
+    std::wstring wRoot = Utf8ToWide(sync_root_path);
+    if (!MatchRegFingerprint(wRoot, RegHash(display_name, version))) {
+        // Registration is missing or differs from what this build would
+        // write; the caller must do the full register + connect sequence.
+        return S_FALSE;
+    }
+
+    // Warm path owns its COM init so callers can skip cfapi_init entirely.
+    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
+    if (FAILED(hr) && hr != RPC_E_CHANGED_MODE) {
+        return static_cast<long>(hr);
+    }
+    return static_cast<long>(ConnectRegisteredRoot(wRoot, root_id, out_key));
+}
+
+long cfapi_connect_sync_root(const char *sync_root_path,
+                              int root_id,
+                              CF_CONNECTION_KEY *out_key)
+{
+    return static_cast<long>(ConnectRegisteredRoot(
+        Utf8ToWide(sync_root_path), root_id, out_key));
+}
+
+void cfapi_disconnect_sync_root(CF_CONNECTION_KEY key) {
+    CfDisconnectSyncRoot(key);
+
+    // After CfDisconnectSyncRoot returns, no more callbacks reference the
+    // connection's context.
+    bool lastConnection = false;
+    {
+        std::lock_guard<std::mutex> lock(s_connMutex);
+        auto it = s_connections.find(static_cast<long long>(key));
+        if (it != s_connections.end()) {
+            delete it->second->watcher;  // joins the watcher thread
+            delete it->second;
+            s_connections.erase(it);
+        }
+        lastConnection = s_connections.empty();
+    }
+
+    // The worker pool is shared by all roots; only stop it with the last one.
+    if (lastConnection) {
+        HydrationDispatcher::Instance().Stop();
+    }
+
+    // Cached directory handles may live under this root; drop them so they
+    // don't block dismount.
+    HandleCache::Instance().Flush();
+}
+
+void cfapi_flush_handles(void) {
+    HandleCache::Instance().Flush();
+}
+
+void cfapi_set_hydration_workers(int count) {
+    HydrationDispatcher::Instance().SetWorkerCount(count);
+}
+
+long cfapi_set_process_priority_map(const char *map) {
+    std::unordered_map<std::string, int> parsed;
+
+    const char *p = map ? map : "";
+    while (*p) {
+        const char *end = p;
+        while (*end && *end != ';') end++;
+
+        const char *eq = p;
+        while (eq < end && *eq != '=') eq++;
+        if (eq == p || eq == end) return E_INVALIDARG;
+
+        std::string name = AsciiLower(std::string(p, eq - p));
+        std::string value(eq + 1, end - (eq + 1));
+        if (value == "bulk") {
+            parsed[name] = kPriorityBulk;
+        } else if (value == "interactive") {
+            parsed[name] = kPriorityInteractive;
+        } else {
+            return E_INVALIDARG;
+        }
+
+        p = *end ? end + 1 : end;
+    }
+
+    std::unique_lock<std::shared_mutex> lock(s_priorityMapMutex);
+    s_priorityMap = std::move(parsed);
+    return S_OK;
+}
+
+long cfapi_set_hydration_policy(long long default_bytes_per_sec,
+                                 long long burst_bytes,
+                                 long long global_inflight_bytes,
+                                 const char *overrides)
+{
+    std::unordered_map<std::string, long long> parsed;
+
+    const char *p = overrides ? overrides : "";
+    while (*p) {
+        const char *end = p;
+        while (*end && *end != ';') end++;
+
+        const char *eq = p;
+        while (eq < end && *eq != '=') eq++;
+        if (eq == p || eq == end) return E_INVALIDARG;
+
+        std::string name = AsciiLower(std::string(p, eq - p));
+        char *numEnd = nullptr;
+        long long bps = strtoll(eq + 1, &numEnd, 10);
+        if (numEnd != end || bps < 0) return E_INVALIDARG;
+        parsed[name] = bps;
+
+        p = *end ? end + 1 : end;
+    }
+
+    AdmissionController::Instance().SetPolicy(
+        default_bytes_per_sec, burst_bytes, global_inflight_bytes,
+        std::move(parsed));
+    return S_OK;
+}
+
+int cfapi_poll_events(cfapi_event *buf, int max) {
+    if (!buf || max <= 0) return 0;
+    return EventRing::Instance().Poll(buf, max);
+}
+
+long long cfapi_dropped_events(void) {
+    return EventRing::Instance().Dropped();
+}
+
+void cfapi_intern_invalidate(void) {
+    WideInterner::Instance().Invalidate();
+}
+
+void cfapi_set_population_policy(int on_demand) {
+    s_onDemandPopulation.store(on_demand ? 1 : 0, std::memory_order_relaxed);
+}
+
+long cfapi_fetch_placeholders_complete(CF_CONNECTION_KEY conn_key,
+                                        CF_TRANSFER_KEY transfer_key,
+                                        const cfapi_placeholder_entry *entries,
+                                        int count,
+                                        long status)
+{
+    std::vector<std::wstring> wNames;
+    std::vector<CF_PLACEHOLDER_CREATE_INFO> infos;
+
+    if (status == 0 && count > 0 && entries) {
+        wNames.reserve(count);
+        infos.resize(count);
+        for (int i = 0; i < count; i++) {
+            wNames.push_back(Utf8ToWide(entries[i].name));
+            FillCreateInfo(infos[i], entries[i], wNames.back().c_str());
+        }
+    }
+
+    CF_OPERATION_INFO opInfo = {};
+    opInfo.StructSize = sizeof(opInfo);
+    opInfo.Type = CF_OPERATION_TYPE_TRANSFER_PLACEHOLDERS;
+    opInfo.ConnectionKey = conn_key;
+    opInfo.TransferKey = transfer_key;
+
+    CF_OPERATION_PARAMETERS opParams = {};
+    opParams.ParamSize = CF_SIZE_OF_OP_PARAM(TransferPlaceholders);
+    // The whole directory listing is delivered in one shot; disabling further
+    // on-demand population marks the directory fully populated.
+    opParams.TransferPlaceholders.Flags =
+        CF_OPERATION_TRANSFER_PLACEHOLDERS_FLAG_DISABLE_ON_DEMAND_POPULATION;
+    opParams.TransferPlaceholders.CompletionStatus =
+        status == 0 ? STATUS_SUCCESS : static_cast<NTSTATUS>(status);
+    opParams.TransferPlaceholders.PlaceholderTotalCount.QuadPart = infos.size();
+    opParams.TransferPlaceholders.PlaceholderArray =
+        infos.empty() ? nullptr : infos.data();
+    opParams.TransferPlaceholders.PlaceholderCount =
+        static_cast<DWORD>(infos.size());
+
+    HRESULT hr = CfExecute(&opInfo, &opParams);
+    return static_cast<long>(hr);
+}
+
+long cfapi_unregister_sync_root(const char *sync_root_path) {
+    std::wstring wRoot = Utf8ToWide(sync_root_path);
+    HRESULT hr = CfUnregisterSyncRoot(wRoot.c_str());
+    return static_cast<long>(hr);
+}
+
+long cfapi_create_placeholder(const char *parent_path,
+                               const char *name,
+                               const char *file_identity,
+                               long long file_size,
+                               long long mtime_unix,
+                               int is_directory)
+{
+    const wchar_t *wParent = InternWide(parent_path);
+    std::wstring wName = Utf8ToWide(name);
+
+    cfapi_placeholder_entry entry = {};
+    entry.name = name;
+    entry.file_identity = file_identity;
+    entry.file_size = file_size;
+    entry.mtime_unix = mtime_unix;
+    entry.is_directory = is_directory;
+
+    CF_PLACEHOLDER_CREATE_INFO phInfo;
+    FillCreateInfo(phInfo, entry, wName.c_str());
+
+    HRESULT hr = CfCreatePlaceholders(wParent, &phInfo, 1,
+                                       CF_CREATE_FLAG_NONE, nullptr);
+    if (SUCCEEDED(hr) && FAILED(phInfo.Result)) {
+        hr = phInfo.Result;
+    }
+    if (SUCCEEDED(hr)) {
+        std::wstring abs = std::wstring(wParent) + L'\\' + wName;
+        IndexPutAbs(abs, file_identity,
+                    static_cast<int>(strlen(file_identity)),
+                    file_size, CFAPI_INDEX_STATE_DEHYDRATED);
+        OplogRecordAbs(abs, CFAPI_OPLOG_CREATE, file_size, mtime_unix);
+    }
+    return static_cast<long>(hr);
+}
+
+long cfapi_create_placeholders_batch(const char *parent_path,
+                                      const cfapi_placeholder_entry *entries,
+                                      int count,
+                                      long *out_results)
+{
+    if (count <= 0) return S_OK;
+
+    const wchar_t *wParent = InternWide(parent_path);
+
+    // Wide name storage must outlive the CfCreatePlaceholders call; the
+    // create-info structs only hold pointers into it.
+    std::vector<std::wstring> wNames;
+    wNames.reserve(count);
+    std::vector<CF_PLACEHOLDER_CREATE_INFO> infos(count);
+
+    for (int i = 0; i < count; i++) {
+        wNames.push_back(Utf8ToWide(entries[i].name));
+        FillCreateInfo(infos[i], entries[i], wNames.back().c_str());
+    }
+
+    DWORD processed = 0;
+    HRESULT hr = CfCreatePlaceholders(wParent, infos.data(),
+                                       static_cast<DWORD>(count),
+                                       CF_CREATE_FLAG_NONE, &processed);
+
+    OpJournal *oplog = nullptr;
+    for (int i = 0; i < count; i++) {
+        if (out_results) {
+            out_results[i] = static_cast<long>(infos[i].Result);
+        }
+        if (SUCCEEDED(hr) && SUCCEEDED(infos[i].Result)) {
+            std::wstring abs = std::wstring(wParent) + L'\\' + wNames[i];
+            IndexPutAbs(abs, entries[i].file_identity,
+                        static_cast<int>(strlen(entries[i].file_identity)),
+                        entries[i].file_size, CFAPI_INDEX_STATE_DEHYDRATED);
+            std::string rel;
+            if (OpJournal *o = OplogForAbsPath(abs, &rel)) {
+                o->Append(CFAPI_OPLOG_CREATE, rel.data(),
+                          static_cast<int>(rel.size()), entries[i].file_size,
+                          entries[i].mtime_unix);
+                oplog = o;
+            }
+        }
+    }
+    // One group commit for the whole directory batch.
+    if (oplog) oplog->Commit();
+
+    return static_cast<long>(hr);
+}
+
+/* ---------- Tree Diff Application ---------- */
+
+// cfapi_apply_tree_diff consumes the flat diff blob produced by the Go
+// encoder (see treediff.go).  Layout, all little-endian:
+//
+//   offset 0   u32 magic        'FSD1' (0x31445346)
+//   offset 4   u32 op count
+//   offset 8   u32 arena offset (from blob start)
+//   offset 12  u32 arena length
+//   offset 16  op count * cfapi_diff_op records
+//   arena      UTF-8 strings referenced by the records
+//
+// The encoder emits creates parent-first and deletes child-first, so the
+// blob can be applied in record order.  Runs of creates sharing a parent
+// directory are grouped into one CfCreatePlaceholders call.
+
+namespace {
+
+// Widen an unterminated UTF-8 slice, converting '/' to '\'.
+static std::wstring WidenRelPath(const char *utf8, int len) {
+    if (len <= 0) return L"";
+    int wlen = MultiByteToWideChar(CP_UTF8, 0, utf8, len, nullptr, 0);
+    if (wlen <= 0) return L"";
+    std::wstring result(wlen, L'\0');
+    MultiByteToWideChar(CP_UTF8, 0, utf8, len, &result[0], wlen);
+    for (wchar_t &c : result) {
+        if (c == L'/') c = L'\\';
+    }
+    return result;
+}
+
+// Parent portion of a '/'-separated relative path ("" for top-level names).
+static int ParentLen(const char *path, int len) {
+    for (int i = len - 1; i >= 0; i--) {
+        if (path[i] == '/') return i;
+    }
+    return 0;
+}
+
+static void RecordDiffFailure(cfapi_diff_report *report, HRESULT hr) {
+    report->failures++;
+    if (report->first_error == 0) {
+        report->first_error = static_cast<long>(hr);
+    }
+}
+
+} /* namespace */
+
+long cfapi_apply_tree_diff(const char *root_path,
+                            const void *diff_blob,
+                            long long blob_len,
+                            cfapi_diff_report *out_report)
+{
+    cfapi_diff_report report = {};
+    if (out_report) *out_report = report;
+    if (!root_path || !diff_blob || blob_len < 16) return E_INVALIDARG;
+
+    const unsigned char *blob = static_cast<const unsigned char *>(diff_blob);
+    unsigned int magic, count, arenaOffset, arenaLen;
+    memcpy(&magic, blob, 4);
+    memcpy(&count, blob + 4, 4);
+    memcpy(&arenaOffset, blob + 8, 4);
+    memcpy(&arenaLen, blob + 12, 4);
+
+    if (magic != 0x31445346) return E_INVALIDARG;
+    long long recordsEnd = 16LL + (long long)count * sizeof(cfapi_diff_op);
+    if (recordsEnd > arenaOffset || arenaOffset > blob_len ||
+        (long long)arenaOffset + arenaLen > blob_len) {
+        return E_INVALIDARG;
+    }
+
+    const cfapi_diff_op *ops =
+        reinterpret_cast<const cfapi_diff_op *>(blob + 16);
+    const char *arena = reinterpret_cast<const char *>(blob + arenaOffset);
+    for (unsigned int i = 0; i < count; i++) {
+        if (ops[i].path_offset < 0 || ops[i].path_len < 0 ||
+            ops[i].identity_offset < 0 || ops[i].identity_len < 0 ||
+            (long long)ops[i].path_offset + ops[i].path_len > arenaLen ||
+            (long long)ops[i].identity_offset + ops[i].identity_len > arenaLen) {
+            return E_INVALIDARG;
+        }
+    }
+
+    std::wstring wRoot = Utf8ToWide(root_path);
+    while (!wRoot.empty() && wRoot.back() == L'\\') wRoot.pop_back();
+    PlaceholderIndex *index = IndexForRoot(wRoot);
+    OpJournal *oplog = OplogForRoot(wRoot);
+
+    unsigned int i = 0;
+    while (i < count) {
+        const cfapi_diff_op &op = ops[i];
+        const char *path = arena + op.path_offset;
+
+        if (op.op == CFAPI_DIFF_OP_CREATE) {
+            // Collect the run of creates sharing this op's parent directory.
+            int parentLen = ParentLen(path, op.path_len);
+            unsigned int runEnd = i + 1;
+            while (runEnd < count &&
+                   ops[runEnd].op == CFAPI_DIFF_OP_CREATE) {
+                const char *p = arena + ops[runEnd].path_offset;
+                if (ParentLen(p, ops[runEnd].path_len) != parentLen ||
+                    memcmp(p, path, parentLen) != 0) {
+                    break;
+                }
+                runEnd++;
+            }
+
+            std::wstring wParent = wRoot;
+            if (parentLen > 0) {
+                wParent += L'\\';
+                wParent += WidenRelPath(path, parentLen);
+            }
+
+            int n = static_cast<int>(runEnd - i);
+            std::vector<std::wstring> wNames;
+            wNames.reserve(n);
+            std::vector<CF_PLACEHOLDER_CREATE_INFO> infos(n);
+            for (int j = 0; j < n; j++) {
+                const cfapi_diff_op &c = ops[i + j];
+                const char *p = arena + c.path_offset;
+                int nameOff = parentLen > 0 ? parentLen + 1 : 0;
+                wNames.push_back(
+                    WidenRelPath(p + nameOff, c.path_len - nameOff));
+                FillCreateInfoRaw(infos[j], arena + c.identity_offset,
+                                  c.identity_len, c.file_size, c.mtime_unix,
+                                  c.is_directory, wNames.back().c_str());
+            }
+
+            HRESULT hr = CfCreatePlaceholders(wParent.c_str(), infos.data(),
+                                               static_cast<DWORD>(n),
+                                               CF_CREATE_FLAG_NONE, nullptr);
+            for (int j = 0; j < n; j++) {
+                HRESULT r = FAILED(hr) ? hr : infos[j].Result;
+                if (FAILED(r)) {
+                    RecordDiffFailure(&report, r);
+                } else {
+                    report.creates++;
+                    const cfapi_diff_op &c = ops[i + j];
+                    if (index) {
+                        index->Put(arena + c.identity_offset, c.identity_len,
+                                   arena + c.path_offset, c.path_len,
+                                   c.file_size, -1,
+                                   CFAPI_INDEX_STATE_DEHYDRATED);
+                    }
+                    if (oplog) {
+                        oplog->Append(CFAPI_OPLOG_CREATE,
+                                      arena + c.path_offset, c.path_len,
+                                      c.file_size, c.mtime_unix);
+                    }
+                }
+            }
+            i = runEnd;
+            continue;
+        }
+
+        std::wstring wPath = wRoot + L'\\' + WidenRelPath(path, op.path_len);
+
+        if (op.op == CFAPI_DIFF_OP_UPDATE) {
+            HANDLE hFile = CreateFileW(wPath.c_str(),
+                WRITE_DAC, FILE_SHARE_READ, nullptr,
+                OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+            if (hFile == INVALID_HANDLE_VALUE) {
+                RecordDiffFailure(&report,
+                                  HRESULT_FROM_WIN32(GetLastError()));
+                i++;
+                continue;
+            }
+
+            FILETIME ftMtime = UnixToFileTime(op.mtime_unix);
+            CF_FS_METADATA fsMetadata = {};
+            fsMetadata.FileSize.QuadPart = op.file_size;
+            fsMetadata.BasicInfo.LastWriteTime.QuadPart =
+                *reinterpret_cast<LONGLONG *>(&ftMtime);
+            fsMetadata.BasicInfo.ChangeTime.QuadPart =
+                *reinterpret_cast<LONGLONG *>(&ftMtime);
+
+            HRESULT hr = CfUpdatePlaceholder(
+                hFile, &fsMetadata,
+                arena + op.identity_offset,
+                static_cast<DWORD>(op.identity_len),
+                nullptr, 0, CF_UPDATE_FLAG_MARK_IN_SYNC,
+                nullptr, nullptr);
+            CloseHandle(hFile);
+            if (FAILED(hr)) {
+                RecordDiffFailure(&report, hr);
+            } else {
+                report.updates++;
+                if (index) {
+                    index->Put(arena + op.identity_offset, op.identity_len,
+                               arena + op.path_offset, op.path_len,
+                               op.file_size, -1,
+                               CFAPI_INDEX_STATE_DEHYDRATED);
+                }
+                if (oplog) {
+                    oplog->Append(CFAPI_OPLOG_UPDATE, arena + op.path_offset,
+                                  op.path_len, op.file_size, op.mtime_unix);
+                }
+            }
+        } else if (op.op == CFAPI_DIFF_OP_DELETE) {
+            BOOL ok = op.is_directory ? RemoveDirectoryW(wPath.c_str())
+                                      : DeleteFileW(wPath.c_str());
+            bool applied = ok != FALSE;
+            if (!ok) {
+                DWORD err = GetLastError();
+                // Already gone counts as applied.
+                if (err == ERROR_FILE_NOT_FOUND || err == ERROR_PATH_NOT_FOUND) {
+                    applied = true;
+                } else {
+                    RecordDiffFailure(&report, HRESULT_FROM_WIN32(err));
+                }
+            }
+            if (applied) {
+                report.deletes++;
+                if (oplog) {
+                    oplog->Append(CFAPI_OPLOG_DELETE, arena + op.path_offset,
+                                  op.path_len, 0, 0);
+                }
+            }
+        } else {
+            return E_INVALIDARG;
+        }
+        i++;
+    }
+
+    // The whole diff is one batch: a single group commit publishes it.
+    if (oplog) oplog->Commit();
+
+    if (out_report) *out_report = report;
+    return S_OK;
+}
+
+/* ---------- Parallel Population ---------- */
+
+// cfapi_populate_tree drives initial placeholder population from inside the
+// shim instead of one directory-per-CGO-call from Go.  The Go side hands
+// over a single 'FSD1' blob (creates only, parent-first) and each run of
+// creates sharing a parent directory becomes one task.  A task is runnable
+// once its parent directory's placeholder exists; idle threads steal
+// runnable tasks from each other's deques.  CfCreatePlaceholders
+// parallelizes well across independent directories, so a large initial
+// population becomes disk-I/O-bound instead of API-call-bound.  Progress is
+// reported through the event ring so the Go side can log it without
+// polling.
+
+namespace {
+
+struct PopulateTask {
+    int firstOp = 0;    // index of the run's first create op
+    int opCount = 0;
+    int parentLen = 0;  // length of the shared parent prefix in the path
+};
+
+struct PopulateState {
+    const cfapi_diff_op *ops = nullptr;
+    const char *arena = nullptr;
+    std::wstring wRoot;
+    PlaceholderIndex *index = nullptr;
+    OpJournal *oplog = nullptr;
+    int rootId = 0;
+
+    std::vector<PopulateTask> tasks;
+    // Relative directory path -> tasks populating that directory.  Sorted
+    // order interleaves a directory's subtrees between its direct children,
+    // so one parent can own several runs.  Read-only once built.
+    std::unordered_map<std::string, std::vector<int>> byParent;
+
+    // One deque per worker under a single lock: owners pop from the back
+    // for locality, thieves take from the front.  Placeholder creation
+    // dwarfs the queue operations, so the shared lock is not contended.
+    std::mutex queueMutex;
+    std::condition_variable queueCv;
+    std::vector<std::deque<int>> queues;
+    int tasksLeft = 0;  // queued, running, or waiting on a parent
+
+    std::atomic<long long> creates{0};
+    std::atomic<long> failures{0};
+    std::atomic<long> firstError{0};
+};
+
+// A failed directory create makes its whole subtree unreachable; count every
+// op under it as failed so the report is honest and tasksLeft still drains.
+// Returns the number of tasks cancelled.
+static int CancelPopulateSubtree(PopulateState *st, int taskIdx) {
+    int cancelled = 0;
+    std::vector<int> stack{taskIdx};
+    while (!stack.empty()) {
+        int t = stack.back();
+        stack.pop_back();
+        cancelled++;
+        const PopulateTask &task = st->tasks[t];
+        for (int j = 0; j < task.opCount; j++) {
+            const cfapi_diff_op &op = st->ops[task.firstOp + j];
+            st->failures.fetch_add(1, std::memory_order_relaxed);
+            if (!op.is_directory) continue;
+            auto it = st->byParent.find(
+                std::string(st->arena + op.path_offset, op.path_len));
+            if (it != st->byParent.end()) {
+                stack.insert(stack.end(), it->second.begin(),
+                             it->second.end());
+            }
+        }
+    }
+    return cancelled;
+}
+
+// Execute one directory run.  Appends newly runnable child tasks to ready
+// and returns the number of tasks cancelled under failed directories.
+static int RunPopulateTask(PopulateState *st, int taskIdx,
+                           std::vector<int> *ready) {
+    const PopulateTask &task = st->tasks[taskIdx];
+    const char *firstPath = st->arena + st->ops[task.firstOp].path_offset;
+
+    std::wstring wParent = st->wRoot;
+    if (task.parentLen > 0) {
+        wParent += L'\\';
+        wParent += WidenRelPath(firstPath, task.parentLen);
+    }
+
+    int n = task.opCount;
+    std::vector<std::wstring> wNames;
+    wNames.reserve(n);
+    std::vector<CF_PLACEHOLDER_CREATE_INFO> infos(n);
+    for (int j = 0; j < n; j++) {
+        const cfapi_diff_op &c = st->ops[task.firstOp + j];
+        const char *p = st->arena + c.path_offset;
+        int nameOff = task.parentLen > 0 ? task.parentLen + 1 : 0;
+        wNames.push_back(WidenRelPath(p + nameOff, c.path_len - nameOff));
+        FillCreateInfoRaw(infos[j], st->arena + c.identity_offset,
+                          c.identity_len, c.file_size, c.mtime_unix,
+                          c.is_directory, wNames.back().c_str());
+    }
+
+    HRESULT hr = CfCreatePlaceholders(wParent.c_str(), infos.data(),
+                                       static_cast<DWORD>(n),
+                                       CF_CREATE_FLAG_NONE, nullptr);
+
+    int cancelled = 0;
+    long long succeeded = 0;
+    for (int j = 0; j < n; j++) {
+        const cfapi_diff_op &c = st->ops[task.firstOp + j];
+        HRESULT r = FAILED(hr) ? hr : infos[j].Result;
+        std::unordered_map<std::string, std::vector<int>>::const_iterator
+            childIt = st->byParent.end();
+        if (c.is_directory) {
+            childIt = st->byParent.find(
+                std::string(st->arena + c.path_offset, c.path_len));
+        }
+
+        if (FAILED(r)) {
+            st->failures.fetch_add(1, std::memory_order_relaxed);
+            long expected = 0;
+            st->firstError.compare_exchange_strong(
+                expected, static_cast<long>(r), std::memory_order_relaxed);
+            if (childIt != st->byParent.end()) {
+                for (int child : childIt->second) {
+                    cancelled += CancelPopulateSubtree(st, child);
+                }
+            }
+            continue;
+        }
+
+        succeeded++;
+        if (st->index) {
+            st->index->Put(st->arena + c.identity_offset, c.identity_len,
+                           st->arena + c.path_offset, c.path_len,
+                           c.file_size, -1, CFAPI_INDEX_STATE_DEHYDRATED);
+        }
+        if (st->oplog) {
+            st->oplog->Append(CFAPI_OPLOG_CREATE, st->arena + c.path_offset,
+                              c.path_len, c.file_size, c.mtime_unix);
+        }
+        if (childIt != st->byParent.end()) {
+            ready->insert(ready->end(), childIt->second.begin(),
+                          childIt->second.end());
+        }
+    }
+    // Group commit: each directory task publishes its creates in one step.
+    if (st->oplog && succeeded > 0) st->oplog->Commit();
+
+    // One progress event per 4096 creates: enough for a responsive log line
+    // on a multi-million-node population without flooding the ring.
+    long long after =
+        st->creates.fetch_add(succeeded, std::memory_order_relaxed) +
+        succeeded;
+    if (succeeded > 0 && (after >> 12) != ((after - succeeded) >> 12)) {
+        EventRing::Instance().PushRaw(st->rootId, CFAPI_EVENT_POPULATE, 0,
+                                      after, L"");
+    }
+    return cancelled;
+}
+
+static void PopulateWorker(PopulateState *st, int self) {
+    std::unique_lock<std::mutex> lock(st->queueMutex);
+    for (;;) {
+        int task = -1;
+        std::deque<int> &own = st->queues[self];
+        if (!own.empty()) {
+            task = own.back();
+            own.pop_back();
+        } else {
+            for (size_t i = 1; task < 0 && i < st->queues.size(); i++) {
+                std::deque<int> &other =
+                    st->queues[(self + i) % st->queues.size()];
+                if (!other.empty()) {
+                    task = other.front();
+                    other.pop_front();
+                }
+            }
+        }
+
+        if (task < 0) {
+            if (st->tasksLeft == 0) return;
+            st->queueCv.wait(lock);
+            continue;
+        }
+
+        lock.unlock();
+        std::vector<int> ready;
+        int cancelled = RunPopulateTask(st, task, &ready);
+        lock.lock();
+
+        st->tasksLeft -= 1 + cancelled;
+        for (int t : ready) st->queues[self].push_back(t);
+        if (st->tasksLeft == 0 || !ready.empty()) {
+            st->queueCv.notify_all();
+        }
+    }
+}
+
+} /* namespace */
+
+long cfapi_populate_tree(const char *root_path,
+                          int root_id,
+                          const void *tree_blob,
+                          long long blob_len,
+                          int threads,
+                          cfapi_diff_report *out_report)
+{
+    cfapi_diff_report report = {};
+    if (out_report) *out_report = report;
+    if (!root_path || !tree_blob || blob_len < 16) return E_INVALIDARG;
+
+    const unsigned char *blob = static_cast<const unsigned char *>(tree_blob);
+    unsigned int magic, count, arenaOffset, arenaLen;
+    memcpy(&magic, blob, 4);
+    memcpy(&count, blob + 4, 4);
+    memcpy(&arenaOffset, blob + 8, 4);
+    memcpy(&arenaLen, blob + 12, 4);
+
+    if (magic != 0x31445346) return E_INVALIDARG;
+    long long recordsEnd = 16LL + (long long)count * sizeof(cfapi_diff_op);
+    if (recordsEnd > arenaOffset || arenaOffset > blob_len ||
+        (long long)arenaOffset + arenaLen > blob_len) {
+        return E_INVALIDARG;
+    }
+
+    const cfapi_diff_op *ops =
+        reinterpret_cast<const cfapi_diff_op *>(blob + 16);
+    const char *arena = reinterpret_cast<const char *>(blob + arenaOffset);
+    for (unsigned int i = 0; i < count; i++) {
+        // Population is creates only; updates and deletes belong to
+        // cfapi_apply_tree_diff.
+        if (ops[i].op != CFAPI_DIFF_OP_CREATE) return E_INVALIDARG;
+        if (ops[i].path_offset < 0 || ops[i].path_len < 0 ||
+            ops[i].identity_offset < 0 || ops[i].identity_len < 0 ||
+            (long long)ops[i].path_offset + ops[i].path_len > arenaLen ||
+            (long long)ops[i].identity_offset + ops[i].identity_len > arenaLen) {
+            return E_INVALIDARG;
+        }
+    }
+    if (count == 0) return S_OK;
+
+    PopulateState st;
+    st.ops = ops;
+    st.arena = arena;
+    st.wRoot = Utf8ToWide(root_path);
+    while (!st.wRoot.empty() && st.wRoot.back() == L'\\') st.wRoot.pop_back();
+    st.index = IndexForRoot(st.wRoot);
+    st.oplog = OplogForRoot(st.wRoot);
+    st.rootId = root_id;
+
+    // One task per run of creates sharing a parent, as in apply_tree_diff.
+    std::unordered_set<std::string> createdDirs;
+    unsigned int i = 0;
+    while (i < count) {
+        const char *path = arena + ops[i].path_offset;
+        int parentLen = ParentLen(path, ops[i].path_len);
+        unsigned int runEnd = i + 1;
+        while (runEnd < count) {
+            const char *p = arena + ops[runEnd].path_offset;
+            if (ParentLen(p, ops[runEnd].path_len) != parentLen ||
+                memcmp(p, path, parentLen) != 0) {
+                break;
+            }
+            runEnd++;
+        }
 
-// This callback is invoked by CfAPI when Explorer or an application reads a
-// placeholder file.  We dispatch to Go via goHydrationCallback.
-static void CALLBACK FetchDataCallback(
-    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
-    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
-{
-    // Extract file identity (our file ID stored as a UTF-8 string blob).
-    const char *fileIdentity = static_cast<const char *>(callbackInfo->FileIdentity);
-    int fileIdentityLen = static_cast<int>(callbackInfo->FileIdentityLength);
+        int taskIdx = static_cast<int>(st.tasks.size());
+        PopulateTask task;
+        task.firstOp = static_cast<int>(i);
+        task.opCount = static_cast<int>(runEnd - i);
+        task.parentLen = parentLen;
+        st.tasks.push_back(task);
+        st.byParent[std::string(path, parentLen)].push_back(taskIdx);
 
-    long long offset = callbackParameters->FetchData.RequiredFileOffset.QuadPart;
-    long long length = callbackParameters->FetchData.RequiredLength.QuadPart;
+        for (unsigned int j = i; j < runEnd; j++) {
+            if (ops[j].is_directory) {
+                createdDirs.insert(std::string(arena + ops[j].path_offset,
+                                               ops[j].path_len));
+            }
+        }
+        i = runEnd;
+    }
 
-    CF_TRANSFER_KEY transferKey = callbackInfo->TransferKey;
+    if (threads <= 0) {
+        threads = static_cast<int>(std::thread::hardware_concurrency());
+    }
+    if (threads < 1) threads = 1;
+    if (threads > 32) threads = 32;
+    if (threads > static_cast<int>(st.tasks.size())) {
+        threads = static_cast<int>(st.tasks.size());
+    }
 
-    // Dispatch to Go.
-    goHydrationCallback(fileIdentity, fileIdentityLen, offset, length, transferKey);
-}
+    // Tasks under the root, or whose parent the blob never creates (it must
+    // already exist on disk), start runnable; everything else is released by
+    // its parent's create.  Spread the seeds round-robin so workers start
+    // with distinct subtrees.
+    st.queues.resize(threads);
+    st.tasksLeft = static_cast<int>(st.tasks.size());
+    int seed = 0;
+    for (size_t t = 0; t < st.tasks.size(); t++) {
+        const PopulateTask &task = st.tasks[t];
+        if (task.parentLen == 0 ||
+            !createdDirs.count(std::string(
+                arena + st.ops[task.firstOp].path_offset, task.parentLen))) {
+            st.queues[seed++ % threads].push_back(static_cast<int>(t));
+        }
+    }
 
-// Callback for cancel fetch (no-op; Go side handles timeouts).
-static void CALLBACK CancelFetchDataCallback(
-    _In_ CONST CF_CALLBACK_INFO *callbackInfo,
-    _In_ CONST CF_CALLBACK_PARAMETERS *callbackParameters)
-{
-    // Intentionally empty.  The Go side will time out or cancel the context.
+    std::vector<std::thread> workers;
+    workers.reserve(threads);
+    for (int w = 0; w < threads; w++) {
+        workers.emplace_back(PopulateWorker, &st, w);
+    }
+    for (std::thread &w : workers) w.join();
+
+    report.creates =
+        static_cast<int>(st.creates.load(std::memory_order_relaxed));
+    report.failures =
+        static_cast<int>(st.failures.load(std::memory_order_relaxed));
+    report.first_error = st.firstError.load(std::memory_order_relaxed);
+    if (out_report) *out_report = report;
+    return S_OK;
 }
 
-// Callback table registered with CfConnectSyncRoot.
-static CF_CALLBACK_REGISTRATION s_callbackTable[] = {
-    { CF_CALLBACK_TYPE_FETCH_DATA,         FetchDataCallback },
-    { CF_CALLBACK_TYPE_CANCEL_FETCH_DATA,  CancelFetchDataCallback },
-    CF_CALLBACK_REGISTRATION_END
-};
+/* ---------- Placeholder Scanner ---------- */
 
-/* ---------- Public API ---------- */
+// Iterative DFS over the sync root using large-fetch directory enumeration.
+// Placeholder state comes straight from the find data, so a scan is pure
+// sequential metadata I/O with no per-file handle opens.
+namespace {
 
-extern "C" {
+struct ScanSession {
+    std::wstring root;                  // absolute root, no trailing slash
+    std::vector<std::wstring> pending;  // directories relative to root
+    HANDLE find = INVALID_HANDLE_VALUE;
+    std::wstring currentDir;            // relative dir being enumerated
+    WIN32_FIND_DATAW data = {};
+    bool entryPending = false;          // data holds an unprocessed entry
+};
 
-long cfapi_init(void) {
-    HRESULT hr = CoInitializeEx(nullptr, COINIT_MULTITHREADED);
-    // S_OK or S_FALSE (already initialized) are both acceptable.
-    if (FAILED(hr) && hr != RPC_E_CHANGED_MODE) {
-        return static_cast<long>(hr);
+} /* namespace */
+
+void *cfapi_scan_begin(const char *root_path) {
+    ScanSession *scan = new (std::nothrow) ScanSession();
+    if (!scan) return nullptr;
+    scan->root = Utf8ToWide(root_path);
+    while (!scan->root.empty() && scan->root.back() == L'\\') {
+        scan->root.pop_back();
     }
-    return 0;
+    scan->pending.push_back(L"");  // start at the root itself
+    return scan;
 }
 
-long cfapi_register_sync_root(const char *sync_root_path,
-                               const char *display_name,
-                               const char *version)
+int cfapi_scan_next(void *scan_handle,
+                     cfapi_scan_record *records,
+                     int max_records,
+                     char *path_arena,
+                     int arena_len)
 {
-    std::wstring wRoot = Utf8ToWide(sync_root_path);
-    std::wstring wName = Utf8ToWide(display_name);
-    std::wstring wVer  = Utf8ToWide(version);
+    ScanSession *scan = static_cast<ScanSession *>(scan_handle);
+    if (!scan || !records || max_records <= 0 || !path_arena || arena_len <= 0) {
+        return -1;
+    }
 
-    CF_SYNC_REGISTRATION reg = {};
-    reg.StructSize = sizeof(reg);
-    reg.ProviderName = wName.c_str();
-    reg.ProviderVersion = wVer.c_str();
-    // Use a fixed GUID for FruitSalade.
-    // {A1B2C3D4-E5F6-7890-ABCD-EF1234567890}
-    static const CLSID s_providerId =
-        { 0xa1b2c3d4, 0xe5f6, 0x7890, { 0xab, 0xcd, 0xef, 0x12, 0x34, 0x56, 0x78, 0x90 } };
-    reg.ProviderId = s_providerId;
+    int count = 0;
+    int arenaUsed = 0;
 
-    CF_SYNC_POLICIES policies = {};
-    policies.StructSize = sizeof(policies);
-    policies.Hydration.Primary = CF_HYDRATION_POLICY_FULL;
-    policies.Population.Primary = CF_POPULATION_POLICY_FULL;
-    policies.InSync = CF_INSYNC_POLICY_TRACK_ALL;
-    policies.HardLink = CF_HARDLINK_POLICY_NONE;
+    for (;;) {
+        // Open the next directory if nothing is being enumerated.
+        if (scan->find == INVALID_HANDLE_VALUE && !scan->entryPending) {
+            if (scan->pending.empty()) break;  // scan complete
+            scan->currentDir = scan->pending.back();
+            scan->pending.pop_back();
 
-    HRESULT hr = CfRegisterSyncRoot(wRoot.c_str(), &reg, &policies,
-                                     CF_REGISTER_FLAG_UPDATE);
-    return static_cast<long>(hr);
-}
+            std::wstring pattern = scan->root;
+            if (!scan->currentDir.empty()) {
+                pattern += L'\\';
+                pattern += scan->currentDir;
+            }
+            pattern += L"\\*";
 
-long cfapi_connect_sync_root(const char *sync_root_path,
-                              CF_CONNECTION_KEY *out_key)
-{
-    std::wstring wRoot = Utf8ToWide(sync_root_path);
+            scan->find = FindFirstFileExW(pattern.c_str(), FindExInfoBasic,
+                                          &scan->data, FindExSearchNameMatch,
+                                          nullptr, FIND_FIRST_EX_LARGE_FETCH);
+            if (scan->find == INVALID_HANDLE_VALUE) continue;  // skip unreadable
+            scan->entryPending = true;
+        }
 
-    HRESULT hr = CfConnectSyncRoot(
-        wRoot.c_str(),
-        s_callbackTable,
-        nullptr,    // callbackContext (we use the global backend pointer in Go)
-        CF_CONNECT_FLAG_REQUIRE_PROCESS_INFO |
-            CF_CONNECT_FLAG_REQUIRE_FULL_FILE_PATH,
-        out_key);
+        // Advance if the buffered entry was already consumed.
+        if (!scan->entryPending) {
+            if (!FindNextFileW(scan->find, &scan->data)) {
+                FindClose(scan->find);
+                scan->find = INVALID_HANDLE_VALUE;
+                continue;
+            }
+            scan->entryPending = true;
+        }
 
-    return static_cast<long>(hr);
-}
+        const WIN32_FIND_DATAW &fd = scan->data;
+        if (wcscmp(fd.cFileName, L".") == 0 || wcscmp(fd.cFileName, L"..") == 0) {
+            scan->entryPending = false;
+            continue;
+        }
 
-void cfapi_disconnect_sync_root(CF_CONNECTION_KEY key) {
-    CfDisconnectSyncRoot(key);
-}
+        std::wstring relPath = scan->currentDir.empty()
+                                   ? fd.cFileName
+                                   : scan->currentDir + L'\\' + fd.cFileName;
 
-long cfapi_unregister_sync_root(const char *sync_root_path) {
-    std::wstring wRoot = Utf8ToWide(sync_root_path);
-    HRESULT hr = CfUnregisterSyncRoot(wRoot.c_str());
-    return static_cast<long>(hr);
-}
+        std::string utf8Path = WideToUtf8(relPath.c_str(),
+                                          static_cast<int>(relPath.size()));
 
-long cfapi_create_placeholder(const char *parent_path,
-                               const char *name,
-                               const char *file_identity,
-                               long long file_size,
-                               long long mtime_unix,
-                               int is_directory)
-{
-    std::wstring wParent = Utf8ToWide(parent_path);
-    std::wstring wName   = Utf8ToWide(name);
+        // Batch full? Leave the entry buffered for the next call.
+        if (count >= max_records ||
+            arenaUsed + static_cast<int>(utf8Path.size()) > arena_len) {
+            return count;
+        }
 
-    FILETIME ftMtime = UnixToFileTime(mtime_unix);
+        if (fd.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY) {
+            scan->pending.push_back(relPath);
+        }
 
-    CF_PLACEHOLDER_CREATE_INFO phInfo = {};
-    phInfo.FileIdentity = file_identity;
-    phInfo.FileIdentityLength = static_cast<DWORD>(strlen(file_identity));
-    phInfo.RelativeFileName = wName.c_str();
-    phInfo.FsMetadata.FileSize.QuadPart = file_size;
-    phInfo.FsMetadata.BasicInfo.CreationTime.QuadPart =
-        *reinterpret_cast<LONGLONG *>(&ftMtime);
-    phInfo.FsMetadata.BasicInfo.LastWriteTime.QuadPart =
-        *reinterpret_cast<LONGLONG *>(&ftMtime);
-    phInfo.FsMetadata.BasicInfo.ChangeTime.QuadPart =
-        *reinterpret_cast<LONGLONG *>(&ftMtime);
-    phInfo.FsMetadata.BasicInfo.LastAccessTime.QuadPart =
-        *reinterpret_cast<LONGLONG *>(&ftMtime);
+        CF_PLACEHOLDER_STATE state = CF_PLACEHOLDER_STATE_NO_STATES;
+        CfGetPlaceholderStateFromFindData(&fd, &state);
 
-    if (is_directory) {
-        phInfo.FsMetadata.BasicInfo.FileAttributes = FILE_ATTRIBUTE_DIRECTORY;
-        phInfo.Flags = CF_PLACEHOLDER_CREATE_FLAG_MARK_IN_SYNC |
-                       CF_PLACEHOLDER_CREATE_FLAG_DISABLE_ON_DEMAND_POPULATION;
-    } else {
-        phInfo.FsMetadata.BasicInfo.FileAttributes = FILE_ATTRIBUTE_NORMAL;
-        phInfo.Flags = CF_PLACEHOLDER_CREATE_FLAG_MARK_IN_SYNC;
+        cfapi_scan_record &rec = records[count];
+        rec.path_offset = arenaUsed;
+        rec.path_len = static_cast<int>(utf8Path.size());
+        rec.state = static_cast<unsigned int>(state);
+        rec.attributes = fd.dwFileAttributes;
+        rec.size = (static_cast<long long>(fd.nFileSizeHigh) << 32) |
+                   fd.nFileSizeLow;
+        rec.last_access_unix = FileTimeToUnix(fd.ftLastAccessTime);
+
+        memcpy(path_arena + arenaUsed, utf8Path.data(), utf8Path.size());
+        arenaUsed += static_cast<int>(utf8Path.size());
+        count++;
+        scan->entryPending = false;
     }
 
-    phInfo.Result = S_OK;
+    return count;
+}
 
-    HRESULT hr = CfCreatePlaceholders(wParent.c_str(), &phInfo, 1,
-                                       CF_CREATE_FLAG_NONE, nullptr);
-    if (SUCCEEDED(hr) && FAILED(phInfo.Result)) {
-        hr = phInfo.Result;
+void cfapi_scan_end(void *scan_handle) {
+    ScanSession *scan = static_cast<ScanSession *>(scan_handle);
+    if (!scan) return;
+    if (scan->find != INVALID_HANDLE_VALUE) {
+        FindClose(scan->find);
     }
-    return static_cast<long>(hr);
+    delete scan;
 }
 
 long cfapi_update_placeholder(const char *file_path,
@@ -211,13 +4535,10 @@ long cfapi_update_placeholder(const char *file_path,
                                long long file_size,
                                long long mtime_unix)
 {
-    std::wstring wPath = Utf8ToWide(file_path);
+    const wchar_t *wPath = InternWide(file_path);
     FILETIME ftMtime = UnixToFileTime(mtime_unix);
 
-    HANDLE hFile = CreateFileW(wPath.c_str(),
-        WRITE_DAC, FILE_SHARE_READ, nullptr,
-        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
-
+    HANDLE hFile = OpenPlaceholderForWrite(wPath);
     if (hFile == INVALID_HANDLE_VALUE) {
         return static_cast<long>(HRESULT_FROM_WIN32(GetLastError()));
     }
@@ -239,49 +4560,624 @@ long cfapi_update_placeholder(const char *file_path,
         nullptr, nullptr);
 
     CloseHandle(hFile);
+    if (SUCCEEDED(hr)) {
+        IndexPutAbs(wPath, file_identity,
+                    static_cast<int>(strlen(file_identity)),
+                    file_size, CFAPI_INDEX_STATE_DEHYDRATED);
+        OplogRecordAbs(wPath, CFAPI_OPLOG_UPDATE, file_size, mtime_unix);
+    }
     return static_cast<long>(hr);
 }
 
 long cfapi_dehydrate_placeholder(const char *file_path) {
-    std::wstring wPath = Utf8ToWide(file_path);
-
-    HANDLE hFile = CreateFileW(wPath.c_str(),
-        WRITE_DAC, FILE_SHARE_READ, nullptr,
-        OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS, nullptr);
+    const wchar_t *wPath = InternWide(file_path);
 
+    HANDLE hFile = OpenPlaceholderForWrite(wPath);
     if (hFile == INVALID_HANDLE_VALUE) {
         return static_cast<long>(HRESULT_FROM_WIN32(GetLastError()));
     }
 
     HRESULT hr = CfDehydratePlaceholder(hFile, 0, -1,
                                          CF_DEHYDRATE_FLAG_NONE, nullptr);
+
+    if (SUCCEEDED(hr)) {
+        // Reflect the new state in the placeholder index; the identity is
+        // read back from the placeholder since callers only pass the path.
+        std::string rel;
+        PlaceholderIndex *index = IndexForAbsPath(wPath, &rel);
+        if (index) {
+            char buf[sizeof(CF_PLACEHOLDER_STANDARD_INFO) + 256];
+            DWORD returned = 0;
+            CF_PLACEHOLDER_STANDARD_INFO *info =
+                reinterpret_cast<CF_PLACEHOLDER_STANDARD_INFO *>(buf);
+            if (SUCCEEDED(CfGetPlaceholderInfo(
+                    hFile, CF_PLACEHOLDER_INFO_STANDARD, buf,
+                    static_cast<DWORD>(sizeof(buf)), &returned)) &&
+                info->FileIdentityLength > 0) {
+                index->SetState(
+                    reinterpret_cast<const char *>(info->FileIdentity),
+                    static_cast<int>(info->FileIdentityLength),
+                    CFAPI_INDEX_STATE_DEHYDRATED);
+            }
+        }
+    }
+
     CloseHandle(hFile);
+    if (SUCCEEDED(hr)) {
+        OplogRecordAbs(wPath, CFAPI_OPLOG_DEHYDRATE, 0, 0);
+    }
+    return static_cast<long>(hr);
+}
+
+long cfapi_index_open(const char *sync_root_path) {
+    std::wstring root = Utf8ToWide(sync_root_path);
+    while (!root.empty() && root.back() == L'\\') root.pop_back();
+    if (root.empty()) return E_INVALIDARG;
+    if (IndexForRoot(root)) return S_OK;
+
+    PlaceholderIndex *idx = new (std::nothrow) PlaceholderIndex(root);
+    if (!idx) return E_OUTOFMEMORY;
+    if (!idx->Open()) {
+        delete idx;
+        return E_FAIL;
+    }
+
+    std::lock_guard<std::mutex> lock(s_indexMutex);
+    s_indexes.push_back(idx);
+    return S_OK;
+}
+
+long cfapi_journal_open(const char *sync_root_path, int root_id) {
+    std::wstring root = Utf8ToWide(sync_root_path);
+    while (!root.empty() && root.back() == L'\\') root.pop_back();
+    if (root.empty()) return E_INVALIDARG;
+    if (JournalForRoot(root)) return S_OK;
+
+    DirtyJournal *journal = new (std::nothrow) DirtyJournal(root_id, root);
+    if (!journal) return E_OUTOFMEMORY;
+    HRESULT hr = journal->Open();
+    if (FAILED(hr)) {
+        delete journal;
+        return static_cast<long>(hr);
+    }
+
+    std::lock_guard<std::mutex> lock(s_journalMutex);
+    s_journals.push_back(journal);
+    return S_OK;
+}
+
+void cfapi_journal_close(const char *sync_root_path) {
+    std::wstring root = Utf8ToWide(sync_root_path);
+    while (!root.empty() && root.back() == L'\\') root.pop_back();
+
+    std::lock_guard<std::mutex> lock(s_journalMutex);
+    for (size_t i = 0; i < s_journals.size(); i++) {
+        if (_wcsicmp(s_journals[i]->Root().c_str(), root.c_str()) == 0) {
+            delete s_journals[i];
+            s_journals.erase(s_journals.begin() + i);
+            return;
+        }
+    }
+}
+
+int cfapi_drain_dirty(cfapi_dirty_record *out, int max) {
+    if (!out || max <= 0) return -1;
+
+    // Snapshot the journal list, then drain outside the registry lock so a
+    // concurrent close cannot deadlock against a long drain.
+    std::vector<DirtyJournal *> journals;
+    {
+        std::lock_guard<std::mutex> lock(s_journalMutex);
+        journals = s_journals;
+    }
+
+    int n = 0;
+    for (DirtyJournal *journal : journals) {
+        if (n >= max) break;
+        n += journal->Drain(out + n, max - n);
+    }
+    return n;
+}
+
+long cfapi_set_in_sync(const char *file_path) {
+    std::wstring wPath = Utf8ToWide(file_path);
+    if (wPath.empty()) return E_INVALIDARG;
+
+    HANDLE h = CreateFileW(wPath.c_str(), FILE_WRITE_ATTRIBUTES,
+                           FILE_SHARE_READ | FILE_SHARE_WRITE |
+                               FILE_SHARE_DELETE,
+                           nullptr, OPEN_EXISTING, FILE_FLAG_BACKUP_SEMANTICS,
+                           nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+    HRESULT hr = CfSetInSyncState(h, CF_IN_SYNC_STATE_IN_SYNC,
+                                  CF_SET_IN_SYNC_FLAG_NONE, nullptr);
+    CloseHandle(h);
+
+    // Confirm the journal entry whether or not the in-sync flip succeeded:
+    // the upload is done either way, and a stuck entry would re-upload the
+    // same bytes every drain cycle.
+    std::string rel;
+    DirtyJournal *journal = JournalForAbsPath(wPath, &rel);
+    if (journal) {
+        journal->Clear(rel.c_str(), static_cast<int>(rel.size()));
+    }
     return static_cast<long>(hr);
 }
 
+long cfapi_oplog_open(const char *sync_root_path) {
+    std::wstring root = Utf8ToWide(sync_root_path);
+    while (!root.empty() && root.back() == L'\\') root.pop_back();
+    if (root.empty()) return E_INVALIDARG;
+    if (OplogForRoot(root)) return S_OK;
+
+    OpJournal *oplog = new (std::nothrow) OpJournal(root);
+    if (!oplog) return E_OUTOFMEMORY;
+    HRESULT hr = oplog->Open();
+    if (FAILED(hr)) {
+        delete oplog;
+        return static_cast<long>(hr);
+    }
+
+    std::lock_guard<std::mutex> lock(s_oplogMutex);
+    s_oplogs.push_back(oplog);
+    return S_OK;
+}
+
+void cfapi_oplog_close(const char *sync_root_path) {
+    std::wstring root = Utf8ToWide(sync_root_path);
+    while (!root.empty() && root.back() == L'\\') root.pop_back();
+
+    std::lock_guard<std::mutex> lock(s_oplogMutex);
+    for (size_t i = 0; i < s_oplogs.size(); i++) {
+        if (_wcsicmp(s_oplogs[i]->Root().c_str(), root.c_str()) == 0) {
+            s_oplogs[i]->Close();
+            delete s_oplogs[i];
+            s_oplogs.erase(s_oplogs.begin() + i);
+            return;
+        }
+    }
+}
+
+long cfapi_recover(const char *sync_root_path, long long *out_resume_point) {
+    if (!out_resume_point) return E_INVALIDARG;
+    *out_resume_point = 0;
+
+    std::wstring root = Utf8ToWide(sync_root_path);
+    while (!root.empty() && root.back() == L'\\') root.pop_back();
+    if (root.empty()) return E_INVALIDARG;
+
+    OpJournal *oplog = OplogForRoot(root);
+    if (!oplog) return E_FAIL;  // call cfapi_oplog_open first
+
+    *out_resume_point = oplog->Recover();
+    return S_OK;
+}
+
+void cfapi_index_close(const char *sync_root_path) {
+    std::wstring root = Utf8ToWide(sync_root_path);
+    while (!root.empty() && root.back() == L'\\') root.pop_back();
+
+    std::lock_guard<std::mutex> lock(s_indexMutex);
+    for (size_t i = 0; i < s_indexes.size(); i++) {
+        if (_wcsicmp(s_indexes[i]->Root().c_str(), root.c_str()) == 0) {
+            delete s_indexes[i];
+            s_indexes.erase(s_indexes.begin() + i);
+            return;
+        }
+    }
+}
+
+int cfapi_lookup_identity(const char *file_identity, int identity_len,
+                           char *out_path, int out_path_cap,
+                           long long *out_size, int *out_version,
+                           unsigned int *out_state)
+{
+    if (!file_identity || identity_len <= 0) return -1;
+
+    std::string path;
+    long long size = 0;
+    int version = 0;
+    unsigned int state = 0;
+
+    std::lock_guard<std::mutex> lock(s_indexMutex);
+    for (PlaceholderIndex *idx : s_indexes) {
+        if (!idx->Lookup(file_identity, identity_len, &path, &size,
+                         &version, &state)) {
+            continue;
+        }
+        if (out_path && out_path_cap > 0) {
+            size_t n = path.size();
+            if (n >= static_cast<size_t>(out_path_cap)) {
+                n = out_path_cap - 1;
+            }
+            memcpy(out_path, path.c_str(), n);
+            out_path[n] = '\0';
+        }
+        if (out_size) *out_size = size;
+        if (out_version) *out_version = version;
+        if (out_state) *out_state = state;
+        return 1;
+    }
+    return 0;
+}
+
+long cfapi_dehydrate_batch(const char **paths, int count, long *out_results) {
+    if (count <= 0) return S_OK;
+    if (!paths || !out_results) return E_INVALIDARG;
+
+    // Dehydration wall time is dominated by per-file handle churn
+    // (CreateFileW -> CfDehydratePlaceholder -> CloseHandle), which overlaps
+    // well across files: run the per-file pipeline on a small pool and
+    // surface per-entry HRESULTs so callers retry only failures.
+    int workers = count < 8 ? count : 8;
+
+    std::atomic<int> next{0};
+    std::vector<std::thread> pool;
+    pool.reserve(workers);
+
+    for (int w = 0; w < workers; w++) {
+        pool.emplace_back([&next, paths, count, out_results] {
+            for (;;) {
+                int i = next.fetch_add(1, std::memory_order_relaxed);
+                if (i >= count) return;
+                out_results[i] = cfapi_dehydrate_placeholder(paths[i]);
+            }
+        });
+    }
+
+    for (auto &worker : pool) {
+        worker.join();
+    }
+
+    return S_OK;
+}
+
 long cfapi_transfer_data(CF_CONNECTION_KEY conn_key,
                           CF_TRANSFER_KEY transfer_key,
                           const void *data,
                           long long offset,
                           long long length)
 {
-    CF_OPERATION_INFO opInfo = {};
-    opInfo.StructSize = sizeof(opInfo);
-    opInfo.Type = CF_OPERATION_TYPE_TRANSFER_DATA;
-    opInfo.ConnectionKey = conn_key;
-    opInfo.TransferKey = transfer_key;
+    return static_cast<long>(
+        ExecuteTransfer(conn_key, transfer_key, data, offset, length));
+}
 
-    CF_OPERATION_PARAMETERS opParams = {};
-    opParams.ParamSize = CF_SIZE_OF_OP_PARAM(TransferData);
-    opParams.TransferData.CompletionStatus = STATUS_SUCCESS;
-    opParams.TransferData.Buffer = data;
-    opParams.TransferData.Offset.QuadPart = offset;
-    opParams.TransferData.Length.QuadPart = length;
+void *cfapi_transfer_begin(CF_CONNECTION_KEY conn_key,
+                            CF_TRANSFER_KEY transfer_key,
+                            const char *identity,
+                            int identity_len)
+{
+    TransferSession *session = new (std::nothrow) TransferSession();
+    if (!session) return nullptr;
+    session->connKey = conn_key;
+    session->transferKey = transfer_key;
+    if (identity && identity_len > 0) {
+        session->identity.assign(identity, identity_len);
+        session->fileVersion = VersionForIdentity(identity, identity_len);
+    }
+    session->buffer.reserve(kTransferBufferSize);
+    return session;
+}
 
-    HRESULT hr = CfExecute(&opInfo, &opParams);
+long cfapi_transfer_chunk(void *session_handle,
+                           const void *data,
+                           long long offset,
+                           long long length)
+{
+    TransferSession *session = static_cast<TransferSession *>(session_handle);
+    if (!session || length < 0) return E_INVALIDARG;
+
+    // Fail fast once the kernel cancelled the request: nobody is waiting on
+    // these bytes, so stop feeding them into CfExecute.
+    if (RangeTracker::Instance().Cancelled(
+            static_cast<long long>(session->connKey),
+            session->transferKey.QuadPart)) {
+        return E_ABORT;
+    }
+
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+
+    // Non-contiguous chunk: flush whatever is buffered first.
+    if (session->bufferStart >= 0 &&
+        session->bufferStart + static_cast<long long>(session->buffer.size()) != offset) {
+        FlushSession(session);
+    }
+
+    while (length > 0) {
+        if (session->bufferStart < 0) {
+            // Large chunks bypass the coalescing buffer entirely.
+            if (static_cast<size_t>(length) >= kTransferBufferSize) {
+                HRESULT hr = ExecuteTransfer(session->connKey, session->transferKey,
+                                             bytes, offset, length);
+                if (FAILED(hr) && SUCCEEDED(session->firstError)) {
+                    session->firstError = hr;
+                }
+                if (SUCCEEDED(hr)) {
+                    session->bytesSent += length;
+                    CachePopulate(session, bytes, offset, length);
+                }
+                return static_cast<long>(session->firstError);
+            }
+            session->bufferStart = offset;
+        }
+
+        size_t room = kTransferBufferSize - session->buffer.size();
+        size_t take = static_cast<size_t>(length) < room
+                          ? static_cast<size_t>(length)
+                          : room;
+        session->buffer.insert(session->buffer.end(), bytes, bytes + take);
+        bytes += take;
+        offset += take;
+        length -= take;
+
+        if (session->buffer.size() == kTransferBufferSize) {
+            FlushSession(session);
+        }
+    }
+
+    return static_cast<long>(session->firstError);
+}
+
+long cfapi_transfer_chunk_compressed(void *session_handle,
+                                      const void *frame,
+                                      long long frame_len,
+                                      long long offset)
+{
+#ifndef FRUITSALADE_WITH_ZSTD
+    (void)session_handle;
+    (void)frame;
+    (void)frame_len;
+    (void)offset;
+    return E_NOTIMPL;
+#else
+    TransferSession *session = static_cast<TransferSession *>(session_handle);
+    if (!session || !frame || frame_len <= 0) return E_INVALIDARG;
+
+    // The first frame pins where the decompressed stream lands in the file;
+    // every following frame continues from wherever the last one ended, so
+    // the offset argument is ignored once the stream is rolling.
+    if (session->plainOffset < 0) {
+        if (offset < 0) return E_INVALIDARG;
+        session->plainOffset = offset;
+    }
+
+    if (!session->zstd) {
+        session->zstd = ZSTD_createDStream();
+        if (!session->zstd) return E_OUTOFMEMORY;
+        session->zstdScratch.resize(ZSTD_DStreamOutSize());
+    }
+    ZSTD_DStream *stream = static_cast<ZSTD_DStream *>(session->zstd);
+
+    // Decompress in place on the calling thread and feed the plain bytes
+    // through cfapi_transfer_chunk, so coalescing, cancellation, readahead
+    // accounting and cache population all stay on the one code path.
+    ZSTD_inBuffer in{frame, static_cast<size_t>(frame_len), 0};
+    while (in.pos < in.size) {
+        ZSTD_outBuffer out{session->zstdScratch.data(),
+                           session->zstdScratch.size(), 0};
+        size_t rc = ZSTD_decompressStream(stream, &out, &in);
+        if (ZSTD_isError(rc)) {
+            // A corrupt frame poisons the whole stream; remember it so
+            // transfer_end reports the failure even if the caller ignores us.
+            if (SUCCEEDED(session->firstError)) session->firstError = E_FAIL;
+            return E_FAIL;
+        }
+        if (out.pos > 0) {
+            long hr = cfapi_transfer_chunk(session_handle,
+                                           session->zstdScratch.data(),
+                                           session->plainOffset,
+                                           static_cast<long long>(out.pos));
+            if (FAILED(hr)) return hr;
+            session->plainOffset += static_cast<long long>(out.pos);
+        }
+    }
+
+    return static_cast<long>(session->firstError);
+#endif
+}
+
+long cfapi_acquire_buffer(void *session_handle,
+                           long long min_size,
+                           void **out_ptr)
+{
+    TransferSession *session = static_cast<TransferSession *>(session_handle);
+    if (!session || min_size <= 0 || !out_ptr) return E_INVALIDARG;
+
+    if (session->zeroCopyCap < static_cast<size_t>(min_size)) {
+        if (session->zeroCopyBuf) {
+            VirtualFree(session->zeroCopyBuf, 0, MEM_RELEASE);
+            session->zeroCopyBuf = nullptr;
+            session->zeroCopyCap = 0;
+        }
+        // Round up to 64 KB allocation granularity; VirtualAlloc returns
+        // page-aligned memory, which keeps CfExecute on its fast path.
+        size_t cap = (static_cast<size_t>(min_size) + 0xFFFF) & ~size_t(0xFFFF);
+        session->zeroCopyBuf = static_cast<unsigned char *>(
+            VirtualAlloc(nullptr, cap, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE));
+        if (!session->zeroCopyBuf) return E_OUTOFMEMORY;
+        session->zeroCopyCap = cap;
+    }
+
+    *out_ptr = session->zeroCopyBuf;
+    return S_OK;
+}
+
+long cfapi_commit_buffer(void *session_handle,
+                          const void *ptr,
+                          long long offset,
+                          long long length)
+{
+    TransferSession *session = static_cast<TransferSession *>(session_handle);
+    if (!session || ptr != session->zeroCopyBuf || length < 0 ||
+        static_cast<size_t>(length) > session->zeroCopyCap) {
+        return E_INVALIDARG;
+    }
+
+    if (RangeTracker::Instance().Cancelled(
+            static_cast<long long>(session->connKey),
+            session->transferKey.QuadPart)) {
+        return E_ABORT;
+    }
+
+    // Keep file order: anything still coalesced precedes this commit.
+    FlushSession(session);
+
+    HRESULT hr = ExecuteTransfer(session->connKey, session->transferKey,
+                                 ptr, offset, length);
+    if (FAILED(hr) && SUCCEEDED(session->firstError)) {
+        session->firstError = hr;
+    }
+    if (SUCCEEDED(hr)) {
+        session->bytesSent += length;
+        CachePopulate(session, static_cast<const unsigned char *>(ptr),
+                      offset, length);
+    }
+    return static_cast<long>(session->firstError);
+}
+
+long cfapi_transfer_end(void *session_handle, long status) {
+    TransferSession *session = static_cast<TransferSession *>(session_handle);
+    if (!session) return E_INVALIDARG;
+
+    if (status == 0) {
+        FlushSession(session);
+    } else if (!RangeTracker::Instance().Cancelled(
+                   static_cast<long long>(session->connKey),
+                   session->transferKey.QuadPart)) {
+        // Caller failed mid-stream: report the error instead of flushing.
+        // A cancelled request is already dead kernel-side; reporting an
+        // error on it would just fail inside CfExecute.
+        cfapi_transfer_error(session->connKey, session->transferKey,
+                             session->bufferStart >= 0 ? session->bufferStart : 0,
+                             status);
+    }
+
+    RangeTracker::Instance().Complete(static_cast<long long>(session->connKey),
+                                      session->transferKey.QuadPart);
+
+    // A clean session is a link-quality sample; failed or cancelled ones
+    // would bias the estimate with server errors rather than bandwidth.
+    if (status == 0 && SUCCEEDED(session->firstError)) {
+        BandwidthGovernor::Instance().Observe(session->bytesSent,
+                                              NowMicros() - session->startUs);
+    }
+
+    HRESULT hr = session->firstError;
+    delete session;
     return static_cast<long>(hr);
 }
 
+void cfapi_set_readahead(long long window_bytes) {
+    if (window_bytes < 0) return;
+    // Keep 4 KB alignment for CfExecute offset rules.
+    s_readaheadWindow.store(window_bytes & ~0xFFFLL, std::memory_order_relaxed);
+}
+
+void cfapi_set_transfer_options(long long stripe_size,
+                                 long long stripe_threshold,
+                                 int max_stripes)
+{
+    if (stripe_size > 0) {
+        long long size = stripe_size & ~0xFFFLL;
+        if (size < 0x1000) size = 0x1000;
+        s_stripeSize.store(size, std::memory_order_relaxed);
+    }
+    if (stripe_threshold >= 0) {
+        s_stripeThreshold.store(stripe_threshold, std::memory_order_relaxed);
+    }
+    if (max_stripes > 0) {
+        // More stripes than workers just queue behind each other.
+        s_maxStripes.store(max_stripes < 128 ? max_stripes : 128,
+                           std::memory_order_relaxed);
+    }
+}
+
+long cfapi_set_block_cache(const char *path, long long max_bytes) {
+    if (!path || !*path) {
+        BlockCache::Instance().Close();
+        return S_OK;
+    }
+    if (max_bytes <= 0) return E_INVALIDARG;
+    return static_cast<long>(
+        BlockCache::Instance().Open(Utf8ToWide(path), max_bytes));
+}
+
+long cfapi_stage_header(const char *identity, int identity_len,
+                         const void *data, long long length)
+{
+    if (!identity || identity_len <= 0 || !data || length <= 0) {
+        return E_INVALIDARG;
+    }
+    if (!BlockCache::Instance().Enabled()) return S_FALSE;
+
+    // Heads start at offset zero, so every byte is block-aligned and the
+    // fetch-data cache probe finds them without special casing; a stale
+    // version key simply never matches and ages out of the ring.
+    BlockCache::Instance().Store(identity, identity_len,
+                                 VersionForIdentity(identity, identity_len),
+                                 static_cast<const unsigned char *>(data),
+                                 0, length);
+    return S_OK;
+}
+
+long cfapi_get_stats(char *out_json, int out_len) {
+    if (!out_json || out_len <= 0) return E_INVALIDARG;
+
+    long long interactiveDepth = 0;
+    long long bulkDepth = 0;
+    HydrationDispatcher::Instance().QueueDepths(&interactiveDepth, &bulkDepth);
+
+    char buf[2048];
+    int n = snprintf(buf, sizeof(buf), "{\"stages\":{");
+    for (int i = 0; i < kStageCount && n > 0 &&
+                    n < static_cast<int>(sizeof(buf)); i++) {
+        const StageHistogram &hist = s_stageHist[i];
+        unsigned long long count = hist.count.load(std::memory_order_relaxed);
+        unsigned long long sumUs = hist.sumUs.load(std::memory_order_relaxed);
+        n += snprintf(buf + n, sizeof(buf) - n,
+                      "%s\"%s\":{\"count\":%llu,\"avg_us\":%llu,"
+                      "\"p50_us\":%lld,\"p99_us\":%lld}",
+                      i > 0 ? "," : "", kStageNames[i], count,
+                      count > 0 ? sumUs / count : 0ULL,
+                      hist.Quantile(0.50), hist.Quantile(0.99));
+    }
+    if (n > 0 && n < static_cast<int>(sizeof(buf))) {
+        n += snprintf(buf + n, sizeof(buf) - n,
+                      "},\"bytes_transferred\":%llu,"
+                      "\"block_cache_hit_bytes\":%llu,"
+                      "\"block_cache_misses\":%llu,"
+                      "\"queue_depth_interactive\":%lld,"
+                      "\"queue_depth_bulk\":%lld,"
+                      "\"range_budget_bytes\":%lld,"
+                      "\"est_bandwidth_bps\":%lld,"
+                      "\"admission_inflight_bytes\":%lld,"
+                      "\"admission_denied\":%lld,"
+                      "\"index_oversized_identities\":%llu,"
+                      "\"events_dropped\":%lld}",
+                      s_statBytesTransferred.load(std::memory_order_relaxed),
+                      BlockCache::s_statCacheHitBytes.load(
+                          std::memory_order_relaxed),
+                      BlockCache::s_statCacheMisses.load(
+                          std::memory_order_relaxed),
+                      interactiveDepth, bulkDepth,
+                      BandwidthGovernor::Instance().RangeBudget(),
+                      BandwidthGovernor::Instance().EstimatedBps(),
+                      AdmissionController::Instance().InflightBytes(),
+                      AdmissionController::Instance().Denied(),
+                      s_statIndexOversized.load(std::memory_order_relaxed),
+                      cfapi_dropped_events());
+    }
+    if (n <= 0 || n >= static_cast<int>(sizeof(buf))) return E_FAIL;
+
+    if (n + 1 > out_len) {
+        return HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER);
+    }
+    memcpy(out_json, buf, n + 1);
+    return S_OK;
+}
+
 void cfapi_transfer_error(CF_CONNECTION_KEY conn_key,
                            CF_TRANSFER_KEY transfer_key,
                            long long offset,
@@ -38,17 +38,81 @@ long cfapi_register_sync_root(const char *sync_root_path,
                                const char *version);
 
 /*
- * Connect to a registered sync root and start receiving callbacks.
+ * Connect to a registered sync root and start receiving callbacks. Several
+ * roots may be connected concurrently in one process; callbacks carry the
+ * root_id back to Go (goHydrationCallbackForRoot and friends) so each
+ * request is routed to the backend that owns the root.
  *   sync_root_path: same path used in register (UTF-8)
+ *   root_id:        caller-chosen identifier for this root (non-zero)
  *   out_key:        receives the connection key (used for transfers)
  * Returns HRESULT.
  */
 long cfapi_connect_sync_root(const char *sync_root_path,
+                              int root_id,
                               CF_CONNECTION_KEY *out_key);
 
-/* Disconnect from a sync root. */
+/*
+ * Fast start: connect to a root registered by a previous run without
+ * rewriting the registration. A successful cfapi_register_sync_root
+ * persists a fingerprint of the registration (provider GUID, display name,
+ * version, population policy) beside the root; when the fingerprint still
+ * matches, this performs COM init and the connection directly — warm starts
+ * skip cfapi_init and the registration rewrite, which is where slow service
+ * starts went. Emits a CFAPI_EVENT_READY record once callbacks are live.
+ *
+ * Returns S_OK on success, S_FALSE when the fingerprint is missing or stale
+ * (fall back to cfapi_init + cfapi_register_sync_root +
+ * cfapi_connect_sync_root), or a failure HRESULT.
+ */
+long cfapi_connect_existing(const char *sync_root_path,
+                             const char *display_name,
+                             const char *version,
+                             int root_id,
+                             CF_CONNECTION_KEY *out_key);
+
+/*
+ * Disconnect from a sync root. The hydration worker pool is shared across
+ * roots and stops when the last connection goes away.
+ */
 void cfapi_disconnect_sync_root(CF_CONNECTION_KEY key);
 
+/*
+ * Set the number of hydration worker threads (default 8, max 128).
+ * FETCH_DATA callbacks are queued and dispatched to Go from this pool, so
+ * hydration concurrency is independent of CfAPI's filter thread budget.
+ * Must be called before cfapi_connect_sync_root; ignored once workers run.
+ */
+void cfapi_set_hydration_workers(int count);
+
+/*
+ * Configure hydration priorities by originating process image. map is a
+ * ';'-separated list of "image=interactive|bulk" entries matched against
+ * the basename of the requesting process, case-insensitively, e.g.
+ * "fruitsalade-pin.exe=bulk". Unlisted processes are interactive.
+ * Interactive requests are dispatched before bulk ones; bulk work waiting
+ * longer than a few seconds is promoted so it cannot starve outright.
+ * Replaces the previous map ("" clears it). Returns E_INVALIDARG on a
+ * malformed entry (map unchanged).
+ */
+long cfapi_set_process_priority_map(const char *map);
+
+/*
+ * Configure hydration admission control. Each originating process image
+ * draws bytes from a token bucket (refilled at default_bytes_per_sec, up to
+ * burst_bytes of headroom), and global_inflight_bytes caps the bytes all
+ * processes may have hydrating at once. Over-budget FETCH_DATA requests are
+ * completed with STATUS_CLOUD_FILE_REQUEST_TIMEOUT, a retryable error, so a
+ * runaway indexer backs off instead of triggering a hydration storm.
+ * overrides is a ';'-separated "image=bytes_per_sec" list matched like the
+ * priority map; 0 exempts that image. Passing 0 for a limit disables it,
+ * and everything is disabled until this is called. Returns E_INVALIDARG on
+ * a malformed overrides entry (policy unchanged).
+ */
+long cfapi_set_hydration_policy(long long default_bytes_per_sec,
+                                 long long burst_bytes,
+                                 long long global_inflight_bytes,
+                                 const char *overrides);
+
 /* Unregister a sync root (removes CfAPI association). */
 long cfapi_unregister_sync_root(const char *sync_root_path);
 
@@ -69,6 +133,155 @@ long cfapi_create_placeholder(const char *parent_path,
                                long long mtime_unix,
                                int is_directory);
 
+/*
+ * Invalidate the shim's interned UTF-8 -> wide path cache. Repeated path
+ * conversions are cached in an arena between calls; the Go side should call
+ * this after each metadata tree refresh so stale paths don't accumulate.
+ * Safe to call concurrently with placeholder operations: retired arenas are
+ * kept alive for a grace period, so pointers held by in-flight calls stay
+ * valid.
+ */
+void cfapi_intern_invalidate(void);
+
+/*
+ * Close the shim's cached parent-directory handles. Placeholder update and
+ * dehydrate open files relative to a small LRU of open directory handles to
+ * skip repeated path resolution; those handles would otherwise block sync
+ * root dismount. Called automatically on cfapi_disconnect_sync_root; the Go
+ * side should also call it before unmounting the volume.
+ */
+void cfapi_flush_handles(void);
+
+/*
+ * One placeholder descriptor for cfapi_create_placeholders_batch.
+ * All strings are UTF-8 and owned by the caller for the duration of the call.
+ *
+ * file_identity is either a bare file ID (v1) or a v2 blob of the form
+ * "FSI2|<file-id>|<sha256-hex>". V2 blobs carry the server's content hash,
+ * which lets the shim answer VALIDATE_DATA for fully resident files by
+ * hashing the local bytes instead of acking blindly. Both forms are opaque
+ * NUL-free text; the shim never interprets v1 blobs.
+ */
+typedef struct cfapi_placeholder_entry {
+    const char *name;          /* file/directory name */
+    const char *file_identity; /* identity blob (see above) */
+    long long file_size;       /* file size in bytes (0 for directories) */
+    long long mtime_unix;      /* modification time as Unix timestamp */
+    int is_directory;          /* 1 for directory, 0 for file */
+} cfapi_placeholder_entry;
+
+/*
+ * Create all placeholders for one directory in a single CfCreatePlaceholders
+ * call. This is the bulk equivalent of cfapi_create_placeholder: one CGO and
+ * one kernel transition per directory instead of per file.
+ *   parent_path: absolute path to parent directory (UTF-8)
+ *   entries:     array of placeholder descriptors
+ *   count:       number of entries
+ *   out_results: receives one HRESULT per entry (may be NULL)
+ * Returns HRESULT of the batch call itself (0 = S_OK); individual entries can
+ * still fail, check out_results.
+ */
+long cfapi_create_placeholders_batch(const char *parent_path,
+                                      const cfapi_placeholder_entry *entries,
+                                      int count,
+                                      long *out_results);
+
+/*
+ * Select the population policy used by cfapi_register_sync_root.
+ *   on_demand: 0 = full population (the client walks the metadata tree and
+ *              creates every placeholder up front); 1 = partial population
+ *              (directories are filled lazily via the FETCH_PLACEHOLDERS
+ *              callback when Explorer first enumerates them).
+ * Must be called before cfapi_register_sync_root.
+ */
+void cfapi_set_population_policy(int on_demand);
+
+/*
+ * Complete a FETCH_PLACEHOLDERS enumeration by transferring a directory's
+ * children to CfAPI in one operation.
+ *   conn_key:     connection key
+ *   transfer_key: transfer key from goFetchPlaceholdersCallback
+ *   entries:      the directory's children (may be NULL when count is 0)
+ *   count:        number of entries
+ *   status:       0 on success; a failure HRESULT aborts the enumeration
+ * Returns HRESULT.
+ */
+long cfapi_fetch_placeholders_complete(CF_CONNECTION_KEY conn_key,
+                                        CF_TRANSFER_KEY transfer_key,
+                                        const cfapi_placeholder_entry *entries,
+                                        int count,
+                                        long status);
+
+/*
+ * One operation in a serialized metadata diff (see cfapi_apply_tree_diff).
+ * path is '/'-separated and relative to the sync root; path and identity are
+ * unterminated UTF-8 slices into the blob's string arena.
+ */
+#define CFAPI_DIFF_OP_CREATE 0
+#define CFAPI_DIFF_OP_UPDATE 1
+#define CFAPI_DIFF_OP_DELETE 2
+
+typedef struct cfapi_diff_op {
+    int op;                  /* CFAPI_DIFF_OP_* */
+    int is_directory;        /* 1 for directory, 0 for file */
+    int path_offset;         /* offset of the relative path in the arena */
+    int path_len;            /* path length in bytes */
+    int identity_offset;     /* offset of the identity blob in the arena */
+    int identity_len;        /* identity length in bytes (0 for deletes) */
+    long long file_size;     /* file size in bytes */
+    long long mtime_unix;    /* modification time as Unix timestamp */
+} cfapi_diff_op;
+
+/* Outcome of cfapi_apply_tree_diff; counts are successfully applied ops. */
+typedef struct cfapi_diff_report {
+    int creates;
+    int updates;
+    int deletes;
+    int failures;
+    long first_error;        /* HRESULT of the first failed op (0 if none) */
+} cfapi_diff_report;
+
+/*
+ * Apply a whole serialized metadata diff in one call. The blob is a flat,
+ * offset-indexed binary format produced by the Go side:
+ *
+ *   u32 magic 'FSD1', u32 op count, u32 arena offset, u32 arena length,
+ *   then the op records, then the UTF-8 string arena.
+ *
+ * Ops must arrive creates parent-first and deletes child-first; runs of
+ * creates sharing a parent directory become one CfCreatePlaceholders call,
+ * so a bulk-import diff costs one CGO transition and one kernel call per
+ * directory instead of one handle open per node.
+ *
+ * Returns E_INVALIDARG for a malformed blob (nothing applied), S_OK once
+ * the diff has run; per-op failures are tallied in out_report.
+ */
+long cfapi_apply_tree_diff(const char *root_path,
+                            const void *diff_blob,
+                            long long blob_len,
+                            cfapi_diff_report *out_report);
+
+/*
+ * Create the initial placeholder tree on multiple threads. Takes the same
+ * 'FSD1' blob as cfapi_apply_tree_diff but restricted to creates (parent
+ * directories first). Each parent-directory run of creates is one task;
+ * tasks become runnable once their parent placeholder exists and idle
+ * threads work-steal runnable directories, so independent subtrees populate
+ * in parallel. One CFAPI_EVENT_POPULATE record is pushed to the event ring
+ * per ~4096 creates with the cumulative count in `size`.
+ *   root_id: same ID passed to cfapi_connect_sync_root, used for events
+ *   threads: worker count; <= 0 picks the hardware thread count (capped)
+ * Returns E_INVALIDARG for a malformed or non-create blob (nothing applied),
+ * S_OK once population has run; per-op failures land in out_report, and a
+ * failed directory counts its whole unreachable subtree as failures.
+ */
+long cfapi_populate_tree(const char *root_path,
+                          int root_id,
+                          const void *tree_blob,
+                          long long blob_len,
+                          int threads,
+                          cfapi_diff_report *out_report);
+
 /*
  * Update an existing placeholder's metadata.
  *   file_path:     absolute path to the placeholder (UTF-8)
@@ -82,6 +295,153 @@ long cfapi_update_placeholder(const char *file_path,
                                long long file_size,
                                long long mtime_unix);
 
+/*
+ * One result record from cfapi_scan_next. The relative path (UTF-8, no
+ * leading separator) lives in the caller-supplied arena at [path_offset,
+ * path_offset+path_len).
+ */
+typedef struct cfapi_scan_record {
+    int path_offset;            /* offset into the path arena */
+    int path_len;               /* path length in bytes */
+    unsigned int state;         /* CF_PLACEHOLDER_STATE bits */
+    unsigned int attributes;    /* FILE_ATTRIBUTE_* bits (incl. pinned) */
+    long long size;             /* file size in bytes */
+    long long last_access_unix; /* last access time as Unix timestamp */
+} cfapi_scan_record;
+
+/*
+ * Bulk placeholder state scanner. Walks the sync root with large-fetch
+ * directory enumeration and reads pin/hydration state from the find data,
+ * so scanning millions of placeholders costs sequential metadata I/O
+ * instead of a per-file stat and handle open.
+ *
+ *   scan = cfapi_scan_begin(root);            // NULL on allocation failure
+ *   while ((n = cfapi_scan_next(scan, records, max, arena, arena_len)) > 0)
+ *       ...;                                   // 0 = done, -1 = bad args
+ *   cfapi_scan_end(scan);
+ *
+ * Unreadable directories are skipped. Records fill until either the record
+ * or arena capacity is reached.
+ */
+void *cfapi_scan_begin(const char *root_path);
+int cfapi_scan_next(void *scan_handle,
+                     cfapi_scan_record *records,
+                     int max_records,
+                     char *path_arena,
+                     int arena_len);
+void cfapi_scan_end(void *scan_handle);
+
+/*
+ * Persistent placeholder index. The shim maintains a memory-mapped
+ * open-addressing hash table next to each sync root ("<root>.fsidx")
+ * mapping file identity -> {relative path, size, version, state}. It is
+ * updated inline by the placeholder create/update/dehydrate entry points
+ * and survives process restarts, so identity lookups are one warm-page
+ * probe instead of a metadata tree walk and there is no cold-start rebuild.
+ * Entries for placeholders deleted behind the shim's back may be stale;
+ * consumers must tolerate a missing file at the returned path.
+ */
+
+/* state bit: content is not on disk (placeholder only) */
+#define CFAPI_INDEX_STATE_DEHYDRATED 0x1
+
+/*
+ * Open (creating if necessary) the index for a sync root. Call after
+ * cfapi_connect_sync_root; idempotent per root. Returns HRESULT.
+ */
+long cfapi_index_open(const char *sync_root_path);
+
+/* Flush and close a sync root's index. */
+void cfapi_index_close(const char *sync_root_path);
+
+/*
+ * Look up a file identity across all open indexes.
+ *   file_identity/identity_len: identity blob to resolve
+ *   out_path/out_path_cap:      receives the sync-root-relative path
+ *                               ('/'-separated, NUL-terminated, truncated
+ *                               to fit); may be NULL
+ *   out_size/out_version/out_state: optional result fields
+ * Returns 1 when found, 0 when absent, -1 on bad arguments.
+ */
+int cfapi_lookup_identity(const char *file_identity, int identity_len,
+                           char *out_path, int out_path_cap,
+                           long long *out_size, int *out_version,
+                           unsigned int *out_state);
+
+/*
+ * Write-back journal for local edits. The root watcher records modified
+ * files (path, size, mtime) into a memory-mapped "<root>.fsdj" file as they
+ * change, coalescing repeated saves of one file into a single record, so
+ * uploads are driven by change notifications instead of the periodic
+ * refresh. The journal survives crashes: unconfirmed records are handed out
+ * again on the next drain (or the next start).
+ *
+ * cfapi_journal_open/close manage a root's journal (open after connecting;
+ * root_id is echoed in drained records so the caller can route them).
+ * Returns HRESULT.
+ */
+long cfapi_journal_open(const char *sync_root_path, int root_id);
+void cfapi_journal_close(const char *sync_root_path);
+
+typedef struct cfapi_dirty_record {
+    int root_id;                 /* root the file belongs to */
+    long long size;              /* size at the last observed change */
+    long long mtime_unix;        /* mtime at the last observed change */
+    long long first_change_unix; /* when the record was first created */
+    char path[512];              /* sync-root-relative path, UTF-8, '/' */
+} cfapi_dirty_record;
+
+/*
+ * Hand out up to max dirty records across all open journals, marking them
+ * as in flight. A record stays in its journal until cfapi_set_in_sync
+ * confirms the upload; records not confirmed within a few minutes are
+ * handed out again. Returns the number of records written, or -1 on bad
+ * arguments.
+ */
+int cfapi_drain_dirty(cfapi_dirty_record *out, int max);
+
+/*
+ * Confirm that a file's local state has been uploaded: flips the
+ * placeholder to CF_IN_SYNC_STATE_IN_SYNC (so Explorer shows it as synced)
+ * and removes the journal record.
+ *   file_path: absolute path to the file (UTF-8)
+ * Returns HRESULT.
+ */
+long cfapi_set_in_sync(const char *file_path);
+
+/*
+ * Operation journal: a memory-mapped ring log ("<root>.fsol") of every
+ * mutating placeholder operation the shim performs (creates, updates,
+ * dehydrates, deletes). Records are appended first and a committed
+ * sequence number is advanced afterwards — once per batch, so bulk work
+ * group-commits one step per directory. After an unclean shutdown,
+ * cfapi_recover verifies the newest committed records against the
+ * filesystem and returns the sequence the dead process had durably
+ * reached, so restart resumes there instead of re-walking the whole root.
+ */
+#define CFAPI_OPLOG_CREATE 0
+#define CFAPI_OPLOG_UPDATE 1
+#define CFAPI_OPLOG_DEHYDRATE 2
+#define CFAPI_OPLOG_DELETE 3
+
+/*
+ * Open (or create) the operation journal for a sync root. Until this is
+ * called, mutating operations on that root are not journaled. Returns
+ * HRESULT; a corrupt or incompatible journal is recreated empty.
+ */
+long cfapi_oplog_open(const char *sync_root_path);
+
+/* Flush and close the root's operation journal. */
+void cfapi_oplog_close(const char *sync_root_path);
+
+/*
+ * Report where the previous run durably stopped. Requires the journal to
+ * be open. out_resume_point receives the highest committed operation
+ * sequence whose tail verifies against the filesystem (0 for a fresh
+ * journal); operations after it must be re-applied. Returns HRESULT.
+ */
+long cfapi_recover(const char *sync_root_path, long long *out_resume_point);
+
 /*
  * Dehydrate a placeholder (remove local content, keep placeholder).
  *   file_path: absolute path to the file (UTF-8)
@@ -89,6 +449,18 @@ long cfapi_update_placeholder(const char *file_path,
  */
 long cfapi_dehydrate_placeholder(const char *file_path);
 
+/*
+ * Dehydrate many placeholders in one call. The open/dehydrate/close pipeline
+ * runs in parallel across files inside the shim, so a nightly eviction of
+ * 100k+ files pays one CGO transition instead of one per file.
+ *   paths:       array of absolute placeholder paths (UTF-8)
+ *   count:       number of paths
+ *   out_results: receives one HRESULT per path
+ * Returns S_OK once the batch has run; individual failures are reported in
+ * out_results so callers can retry only those entries.
+ */
+long cfapi_dehydrate_batch(const char **paths, int count, long *out_results);
+
 /*
  * Transfer data to satisfy a hydration request.
  *   conn_key:     connection key from cfapi_connect_sync_root
@@ -104,6 +476,205 @@ long cfapi_transfer_data(CF_CONNECTION_KEY conn_key,
                           long long offset,
                           long long length);
 
+/*
+ * Streaming transfer session. Instead of materializing a whole hydration
+ * range and pushing it through cfapi_transfer_data, the caller opens a
+ * session, streams chunks in file order, and closes it. Chunks are coalesced
+ * into an internal 1 MB buffer; CfExecute is only invoked when the buffer
+ * fills, a chunk breaks contiguity, or the session ends, so memory stays
+ * flat at the buffer size regardless of range length.
+ *
+ * Begin returns an opaque session handle (NULL on allocation failure).
+ * Chunk/end return the first HRESULT error seen on the session (0 = S_OK).
+ * End with a non-zero status reports the error to CfAPI instead of flushing.
+ * The handle is invalid after cfapi_transfer_end.
+ *
+ * identity/identity_len name the file the stream belongs to; when a block
+ * cache is configured (cfapi_set_block_cache) the session feeds transferred
+ * blocks into it. Pass NULL/0 to opt the stream out of caching.
+ *
+ * If the kernel cancels the request mid-stream, chunk and commit calls
+ * return E_ABORT; the caller should stop reading and end the session.
+ */
+void *cfapi_transfer_begin(CF_CONNECTION_KEY conn_key,
+                            CF_TRANSFER_KEY transfer_key,
+                            const char *identity,
+                            int identity_len);
+long cfapi_transfer_chunk(void *session_handle,
+                           const void *data,
+                           long long offset,
+                           long long length);
+long cfapi_transfer_end(void *session_handle, long status);
+
+/*
+ * Compressed hydration. Feeds a zstd-framed chunk straight from the HTTP
+ * body into the session: the shim decompresses it and routes the plain
+ * bytes through the normal cfapi_transfer_chunk path (coalescing,
+ * cancellation, block-cache population all apply). offset is the file
+ * position of the first decompressed byte and is only read on the first
+ * call; later frames continue the stream sequentially.
+ *
+ * Frames must arrive in stream order and a session must not mix
+ * compressed and plain chunk calls. Only available when the shim is built
+ * with -DFRUITSALADE_WITH_ZSTD and linked against libzstd; otherwise
+ * returns E_NOTIMPL and the caller should fall back to plain transfers.
+ * Returns HRESULT.
+ */
+long cfapi_transfer_chunk_compressed(void *session_handle,
+                                      const void *frame,
+                                      long long frame_len,
+                                      long long offset);
+
+/*
+ * Zero-copy transfer buffers. cfapi_acquire_buffer hands out a page-aligned,
+ * shim-owned buffer of at least min_size bytes for the session; the caller
+ * deserializes the network response directly into it and commits with
+ * cfapi_commit_buffer, which feeds the same memory to CfExecute — removing
+ * one full copy of every hydrated byte versus cfapi_transfer_chunk.
+ *
+ * The buffer stays valid and reusable until the next acquire with a larger
+ * min_size or cfapi_transfer_end. Commit is synchronous, so the caller may
+ * refill the buffer as soon as it returns. Returns HRESULT.
+ */
+long cfapi_acquire_buffer(void *session_handle,
+                           long long min_size,
+                           void **out_ptr);
+long cfapi_commit_buffer(void *session_handle,
+                          const void *ptr,
+                          long long offset,
+                          long long length);
+
+/*
+ * Set the hydration readahead window in bytes (default 8 MB, 0 disables).
+ * When a transfer key shows sequential access, FETCH_DATA requests are
+ * widened to this window and later requests falling inside the in-flight
+ * range are satisfied without another Go dispatch. Rounded down to 4 KB.
+ *
+ * The window is a ceiling: a bandwidth estimator fed by completed transfer
+ * sessions shrinks the effective range (AIMD) on slow links so first-byte
+ * latency stays bounded, and grows it back toward this value on fast ones.
+ */
+void cfapi_set_readahead(long long window_bytes);
+
+/*
+ * Tune overlapped hydration for large files. FETCH_DATA ranges of at least
+ * stripe_threshold bytes are split into stripes of stripe_size bytes (at most
+ * max_stripes per request) that are dispatched to Go concurrently; each
+ * stripe streams through its own transfer session and completes out of order
+ * as its bytes arrive, so a large file hydrates over parallel range requests
+ * instead of one serial stream.
+ *
+ * Defaults: 16 MB stripes, 64 MB threshold, 8 stripes. A stripe_threshold of
+ * 0 disables striping; a negative value leaves the threshold unchanged, and
+ * stripe_size / max_stripes must be positive to take effect. stripe_size is
+ * rounded down to 4 KB for CfExecute's offset alignment rules.
+ *
+ * stripe_size is likewise a ceiling for the bandwidth estimator (see
+ * cfapi_set_readahead): on slow links stripes shrink so each completes
+ * within the latency target instead of stalling Explorer.
+ */
+void cfapi_set_transfer_options(long long stripe_size,
+                                 long long stripe_threshold,
+                                 int max_stripes);
+
+/*
+ * Enable the shim's local block cache at the given UTF-8 path, with at most
+ * max_bytes of content (rounded down to a 1 MB multiple, minimum 16 MB).
+ * Transferred content is stored as 1 MB blocks keyed by (file identity,
+ * version, block index); later hydrations of unchanged files are served from
+ * disk and only cache misses are dispatched to Go. Space is reclaimed by
+ * ring overwrite, oldest blocks first, and a version bump orphans a file's
+ * old blocks, so no explicit invalidation is needed. The cache and its
+ * "<path>.idx" index survive restarts; a corrupt index is rebuilt empty.
+ * Passing a NULL or empty path disables the cache. Returns HRESULT.
+ */
+long cfapi_set_block_cache(const char *path, long long max_bytes);
+
+/*
+ * Stage the leading bytes of a file in the block cache, keyed by its
+ * placeholder identity. Serves the enumeration prefetch path: when a
+ * directory is opened or enumerated the shim asks Go (via
+ * goPrefetchHeadersCallbackForRoot) for the heads of the directory's files
+ * in one batched server call, and Go hands each result here; the thumbnail
+ * read storm Explorer issues next is then answered from local disk. data is
+ * the file's content starting at offset zero. Returns S_FALSE when no block
+ * cache is open, otherwise HRESULT.
+ */
+long cfapi_stage_header(const char *identity, int identity_len,
+                         const void *data, long long length);
+
+/*
+ * Snapshot the shim's internal performance counters as a JSON object into
+ * out_json (NUL-terminated). Per hydration stage (queue_wait, go_dispatch,
+ * cf_execute) it reports count, avg_us and log2-bucketed p50/p99 latencies,
+ * plus bytes transferred, current queue depths and dropped event count.
+ * Counters are cumulative since process start; callers derive rates by
+ * scraping periodically. When built with FRUITSALADE_WITH_ETW the same
+ * stages also emit paired begin/end TraceLogging events under the
+ * "FruitSalade-CfShim" provider for ETW-based investigations.
+ *
+ * Returns S_OK, E_INVALIDARG for bad arguments, or
+ * HRESULT_FROM_WIN32(ERROR_INSUFFICIENT_BUFFER) when out_len is too small
+ * (1 KB is always enough).
+ */
+long cfapi_get_stats(char *out_json, int out_len);
+
+/*
+ * Filesystem events observed by the shim's NOTIFY/VALIDATE callbacks
+ * (renames, deletes, opens, closes, validation requests). The callbacks fire
+ * at very high rates during bulk local operations, so instead of one CGO
+ * transition per event the shim acknowledges them natively and records them
+ * in a fixed ring that Go drains in batches with cfapi_poll_events.
+ *
+ * Paths are UTF-8 and relative to the sync root (no leading separator);
+ * target_path carries the rename destination (NOTIFY_RENAME) or source
+ * (NOTIFY_RENAME_COMPLETION) and is empty otherwise. size is the file size,
+ * except for VALIDATE events where it is the validated range length.
+ */
+#define CFAPI_EVENT_RENAME 1
+#define CFAPI_EVENT_RENAME_COMPLETION 2
+#define CFAPI_EVENT_DELETE 3
+#define CFAPI_EVENT_DELETE_COMPLETION 4
+#define CFAPI_EVENT_FILE_OPEN 5
+#define CFAPI_EVENT_FILE_CLOSE 6
+#define CFAPI_EVENT_VALIDATE 7
+/*
+ * PIN/UNPIN are emitted by the shim's attribute watcher when Explorer's
+ * "Always keep on this device" toggles FILE_ATTRIBUTE_PINNED on a file or
+ * directory. One aggregated record covers the whole subtree; the shim
+ * starts bulk hydration of pinned subtrees itself, so these exist for
+ * visibility (tray UI, logs), not as a request for action.
+ */
+#define CFAPI_EVENT_PIN 8
+#define CFAPI_EVENT_UNPIN 9
+/* Connection is live and callbacks are being served (path is empty). */
+#define CFAPI_EVENT_READY 10
+
+/*
+ * Progress marker from cfapi_populate_tree: `size` carries the cumulative
+ * number of placeholders created so far. Emitted per ~4096 creates.
+ */
+#define CFAPI_EVENT_POPULATE 11
+
+typedef struct cfapi_event {
+    int root_id;            /* root the event belongs to (see connect) */
+    int type;               /* CFAPI_EVENT_* */
+    unsigned int flags;     /* raw CF_CALLBACK_*_FLAGS for the event type */
+    long long size;         /* file size (or range length for VALIDATE) */
+    char path[512];         /* sync-root-relative path, UTF-8 */
+    char target_path[512];  /* rename counterpart path, UTF-8 ("" if none) */
+} cfapi_event;
+
+/*
+ * Drain up to max buffered events into buf. Returns the number copied
+ * (0 when the ring is empty). Events are delivered in arrival order; when
+ * the ring overflows the newest events are dropped and counted.
+ */
+int cfapi_poll_events(cfapi_event *buf, int max);
+
+/* Number of events dropped because the ring was full. */
+long long cfapi_dropped_events(void);
+
 /*
  * Report a transfer error to CfAPI.
  *   conn_key:     connection key
@@ -122,11 +693,58 @@ void cfapi_transfer_error(CF_CONNECTION_KEY conn_key,
 
 /*
  * Go callback declaration (implemented in cfapi_windows.go via //export).
- * Called by the C++ FetchDataCallback when CfAPI requests file data.
+ * Called by the C++ FetchDataCallback when CfAPI requests file data; rootID
+ * identifies which sync root (and therefore which Go backend) the request
+ * belongs to. The exports have C linkage (cgo emits unmangled symbols), so
+ * the declarations must too or the C++ side references mangled names.
+ */
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+extern void goHydrationCallbackForRoot(int rootID,
+                                        const char *fileIdentity,
+                                        int fileIdentityLen,
+                                        long long offset, long long length,
+                                        CF_TRANSFER_KEY transferKey);
+
+/*
+ * Go callback for on-demand directory population (partial population mode).
+ * dirIdentity is the directory's identity blob (empty for the sync root).
+ * The Go side must complete the request with cfapi_fetch_placeholders_complete.
  */
-extern void goHydrationCallback(const char *fileIdentity, int fileIdentityLen,
-                                 long long offset, long long length,
-                                 CF_TRANSFER_KEY transferKey);
+extern void goFetchPlaceholdersCallbackForRoot(int rootID,
+                                                const char *dirIdentity,
+                                                int dirIdentityLen,
+                                                CF_TRANSFER_KEY transferKey,
+                                                CF_CONNECTION_KEY connKey);
+
+/*
+ * Go callback for hydration cancellation.  Invoked from the shim's
+ * CANCEL_FETCH_DATA callback when the kernel abandons an in-flight request;
+ * the Go side cancels the download context for the (connection, transfer)
+ * key so no further bytes are fetched.  Keys are passed as plain integers
+ * because the callback only needs them for a map lookup.
+ */
+extern void goCancelHydrationCallbackForRoot(int rootID,
+                                              long long transferKey,
+                                              long long connKey);
+
+/*
+ * Go callback for enumeration header prefetch.  Invoked when a directory
+ * under a sync root is opened or enumerated; the Go side batches one head
+ * fetch for the directory's files and stages the results with
+ * cfapi_stage_header.  Called from a CfAPI callback thread, so it must
+ * return quickly — the fetch itself runs on a goroutine.  dirIdentity is
+ * empty for the sync root.
+ */
+extern void goPrefetchHeadersCallbackForRoot(int rootID,
+                                              const char *dirIdentity,
+                                              int dirIdentityLen);
+
+#ifdef __cplusplus
+}
+#endif
 
 #else /* !_WIN32 */
 
@@ -2,14 +2,18 @@
 package client
 
 import (
+	"bytes"
 	"compress/gzip"
 	"context"
 	"errors"
 	"fmt"
 	"io"
+	"mime"
+	"mime/multipart"
 	"net"
 	"net/http"
 	"strconv"
+	"strings"
 	"sync"
 	"time"
 
@@ -248,6 +252,80 @@ func (c *Client) FetchContentFull(ctx context.Context, fileID string) (io.ReadCl
 	return c.FetchContent(ctx, fileID, 0, -1)
 }
 
+// HeadResult holds one file's leading bytes from a batched head fetch.
+type HeadResult struct {
+	FileID string
+	Data   []byte
+}
+
+// FetchContentHeads fetches the first length bytes of several files in one
+// round trip via POST /api/v1/content-batch. Files the server could not
+// serve are simply absent from the result, so callers should not assume one
+// entry per requested ID.
+func (c *Client) FetchContentHeads(ctx context.Context, fileIDs []string, length int64) ([]HeadResult, error) {
+	body, err := json.Marshal(protocol.ContentBatchRequest{FileIDs: fileIDs, Length: length})
+	if err != nil {
+		return nil, err
+	}
+
+	var results []HeadResult
+
+	err = retry.Do(ctx, c.retryConfig, func() error {
+		req, err := http.NewRequestWithContext(ctx, "POST",
+			c.baseURL+"/api/v1/content-batch", bytes.NewReader(body))
+		if err != nil {
+			return err
+		}
+		req.Header.Set("Content-Type", "application/json")
+		c.applyAuth(req)
+
+		resp, err := c.httpClient.Do(req)
+		if err != nil {
+			c.setOnline(false)
+			return retry.Retryable(err)
+		}
+		defer resp.Body.Close()
+
+		if resp.StatusCode != http.StatusOK {
+			c.setOnline(false)
+			if resp.StatusCode >= 500 {
+				return retry.Retryable(fmt.Errorf("server error: %d", resp.StatusCode))
+			}
+			return fmt.Errorf("server returned %d", resp.StatusCode)
+		}
+
+		c.setOnline(true)
+
+		mediaType, params, err := mime.ParseMediaType(resp.Header.Get("Content-Type"))
+		if err != nil || !strings.HasPrefix(mediaType, "multipart/") {
+			return fmt.Errorf("unexpected content type %q", resp.Header.Get("Content-Type"))
+		}
+
+		results = results[:0]
+		mr := multipart.NewReader(resp.Body, params["boundary"])
+		for {
+			part, err := mr.NextPart()
+			if err == io.EOF {
+				break
+			}
+			if err != nil {
+				return retry.Retryable(err)
+			}
+			data, err := io.ReadAll(part)
+			if err != nil {
+				return retry.Retryable(err)
+			}
+			results = append(results, HeadResult{
+				FileID: part.Header.Get("X-File-Id"),
+				Data:   data,
+			})
+		}
+		return nil
+	})
+
+	return results, err
+}
+
 // ErrOffline is returned when the server is offline.
 var ErrOffline = errors.New("server is offline")
 
@@ -27,6 +27,16 @@ type ContentRequest struct {
 	Length int64 // From Range header, -1 for full file
 }
 
+// ContentBatchRequest is the body for POST /api/v1/content-batch, which
+// returns the first Length bytes of each listed file in one multipart/mixed
+// response (one part per file, identified by its X-File-Id header). Used to
+// warm client caches ahead of a predictable read storm, e.g. thumbnail
+// reads after a directory enumeration.
+type ContentBatchRequest struct {
+	FileIDs []string `json:"file_ids"`
+	Length  int64    `json:"length"`
+}
+
 // VersionInfo describes a single version of a file.
 type VersionInfo struct {
 	Version   int       `json:"version"`